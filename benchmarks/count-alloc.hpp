@@ -0,0 +1,46 @@
+#ifndef COUNT_ALLOC_HPP
+#define COUNT_ALLOC_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//Counts every global operator new, so a benchmark can report heap
+//allocations per operation. Include it in exactly one file per program: it
+//replaces the global operators.
+
+static std::atomic<long> allocations(0);
+
+#if defined(__GNUC__)
+//Kept out of line: once GCC inlines the free() into a delete expression it
+//sees memory from operator new going to free() and warns
+//(-Wmismatched-new-delete), though these two are a matched pair
+#define COUNT_ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define COUNT_ALLOC_NOINLINE
+#endif
+
+COUNT_ALLOC_NOINLINE void* operator new(size_t n) {
+  ++allocations;
+  if (void* p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+
+//The rest of the family, so nothing reaches free() from an allocator we
+//didn't replace (std::stable_sort's buffer comes from the nothrow one)
+COUNT_ALLOC_NOINLINE void* operator new(size_t n, const std::nothrow_t&) noexcept {
+  ++allocations;
+  return malloc(n ? n : 1);
+}
+
+void* operator new[](size_t n) { return operator new(n); }
+void* operator new[](size_t n, const std::nothrow_t& t) noexcept { return operator new(n, t); }
+
+COUNT_ALLOC_NOINLINE void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+
+#endif
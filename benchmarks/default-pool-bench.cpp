@@ -0,0 +1,34 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../lib/time.hpp"
+#include "../lib/pool.hpp"
+
+//Per-call overhead of the free parallel_for: building a fresh Pool for every
+//call (what it used to do) against reusing the shared default pool.
+
+int main(int argc, char** argv) {
+  int calls = 200;
+  int n = 4096;
+  if (argc >= 2) calls = atoi(argv[1]);
+  if (argc >= 3) n = atoi(argv[2]);
+  std::vector<int> v(n);
+  auto body = [&](int i) { v[i] += i; };
+
+  auto t = now();
+  for (int i = 0; i < calls; ++i) {
+    Pool p;
+    p.parallel_for(0, n, body);
+  }
+  auto fresh = std::chrono::duration<double, std::micro>(now() - t).count() / calls;
+
+  default_pool();
+  t = now();
+  for (int i = 0; i < calls; ++i) parallel_for(0, n, body);
+  auto shared = std::chrono::duration<double, std::micro>(now() - t).count() / calls;
+
+  printf("%d calls over %d elements (fresh pool has %d threads, default pool %d)\n", calls, n, (int) std::thread::hardware_concurrency() * 3, default_pool().size());
+  printf("%-14s %10.1f us/call\n", "fresh Pool", fresh);
+  printf("%-14s %10.1f us/call\n", "default_pool", shared);
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include "../lib/pool.hpp"
+#include "../lib/matrix.hpp"
+#include "../lib/bench.hpp"
+
+//Square and skinny multiplies of int and float matrices: the old i-j-k loop,
+//the blocked multiply on one thread, and the blocked multiply on a Pool.
+//items/s is operations per second (2mnk per multiply).
+//
+//  gemm-bench.out [--max-size=N] [bench options: --repeats=N, --csv, ...]
+//
+//Sizes go up to --max-size (4096 by default). The i-j-k loop stops at 1024,
+//where it already takes seconds per multiply.
+
+//What operator* used to be
+template <typename T>
+basic_matrix<T> naive(const basic_matrix<T>& x, const basic_matrix<T>& y) {
+  basic_matrix<T> z;
+  z.create(x.rows, y.cols);
+  for (unsigned i = 0; i < x.rows; i++) {
+    for (unsigned j = 0; j < y.cols; j++) {
+      T zz = 0;
+      for (unsigned k = 0; k < x.cols; k++) zz += x(i, k) * y(k, j);
+      z(i, j) = zz;
+    }
+  }
+  return z;
+}
+
+template <typename T>
+basic_matrix<T> random_matrix(unsigned rows, unsigned cols, std::mt19937& gen) {
+  basic_matrix<T> m;
+  m.create(rows, cols);
+  std::uniform_int_distribution<int> values(-8, 8);
+  for (unsigned i = 0; i < rows * cols; i++) m.data[i] = static_cast<T>(values(gen));
+  return m;
+}
+
+struct shape {
+  unsigned m, k, n;
+};
+
+template <typename T>
+bool run(cs477::bench& b, Pool& pool, const shape& s, const char* type, std::mt19937& gen) {
+  auto x = random_matrix<T>(s.m, s.k, gen), y = random_matrix<T>(s.k, s.n, gen);
+  auto name = std::to_string(s.m) + "x" + std::to_string(s.k) + "x" + std::to_string(s.n) + " " + type;
+  const double ops = 2.0 * s.m * s.k * s.n;
+  const bool small = static_cast<double>(s.m) * s.k * s.n <= 1024.0 * 1024 * 1024;
+
+  //Small values, so int and float results are exact and must agree
+  if (small) {
+    auto expected = naive(x, y), got = cs477::multiply(pool, x, y);
+    if (memcmp(expected.data, got.data, s.m * s.n * sizeof(T))) {
+      printf("%s: blocked multiply disagrees with the i-j-k loop\n", name.c_str());
+      return false;
+    }
+    b.run(name + " naive", [&]() { cs477::do_not_optimize(naive(x, y)); }).items = ops;
+  }
+  b.run(name + " blocked", [&]() { cs477::do_not_optimize(cs477::multiply(x, y)); }).items = ops;
+  b.run(name + " pool", [&]() { cs477::do_not_optimize(cs477::multiply(pool, x, y)); }).items = ops;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  auto options = cs477::bench_options::from_args(argc, argv);
+  unsigned max_size = 4096;
+  bool repeats = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--max-size=", 11)) max_size = atoi(argv[i] + 11);
+    if (!strncmp(argv[i], "--repeats=", 10)) repeats = true;
+  }
+  //A 4096 multiply is seconds even blocked
+  if (!repeats) options.repeats = 3;
+
+  std::vector<shape> shapes;
+  for (unsigned n = 256; n <= max_size; n *= 2) shapes.push_back(shape{n, n, n});
+  //Skinny: few rows, a short inner dimension, few columns
+  shapes.push_back(shape{64, max_size, max_size});
+  shapes.push_back(shape{max_size, 64, max_size});
+  shapes.push_back(shape{max_size, max_size, 64});
+
+  Pool pool;
+  cs477::bench b(options);
+  std::mt19937 gen(477);
+  printf("kernel: %s, %d threads\n", cs477::multiply_kernel(), pool.size());
+  for (auto& s : shapes) {
+    if (!run<int>(b, pool, s, "int", gen) || !run<float>(b, pool, s, "float", gen)) return 1;
+  }
+  b.report();
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "../lib/time.hpp"
+#include "../lib/pool.hpp"
+#include "count-alloc.hpp"
+
+//Reads a large request body in small segments, the way recv() hands out a
+//big upload, with the old thread-per-iteration Promise::do_while and with
+//cs477::do_while. Reports throughput and heap allocations per segment.
+
+//The loop Promise::do_while used to be: every iteration goes through a new
+//std::async thread, and each one stays blocked until the rest of the loop is
+//done (the discarded std::async future waits in its destructor)
+namespace legacy {
+template <typename T, typename F>
+auto then(std::shared_future<T> fut, F&& f) -> std::future<decltype(f(fut))> {
+  auto p = std::make_shared<std::packaged_task<decltype(f(fut))()>>(std::bind(std::forward<F>(f), fut));
+  auto l = [p]() {
+    (*p)();
+  };
+  std::async(std::launch::async, std::move(l));
+  return p->get_future();
+}
+
+template <class Body>
+void task_loop(std::shared_ptr<std::promise<void>> p, Body body) {
+  auto s = body().share();
+  then(s, [=](std::shared_future<bool> f) {
+    try {
+      if (f.get())
+        task_loop(p, body);
+      else
+        p->set_value();
+    } catch (...) {
+    }
+  });
+}
+
+template <class Body>
+std::future<void> do_while(Body body) {
+  auto p = std::make_shared<std::promise<void>>();
+  std::async(std::launch::async, [=]() {
+    try {
+      task_loop(p, body);
+    } catch (...) {
+    }
+  });
+  return p->get_future();
+}
+}
+
+//Hands out a body one segment at a time
+class mock_source {
+public:
+  mock_source(size_t size, size_t segment) : body(size, 'x'), pos(0), segment(segment) {}
+
+  std::string next() {
+    auto n = std::min(segment, body.size() - pos);
+    auto s = body.substr(pos, n);
+    pos += n;
+    return s;
+  }
+
+  bool done() const {
+    return pos == body.size();
+  }
+
+  void rewind() {
+    pos = 0;
+  }
+
+  size_t size() const {
+    return body.size();
+  }
+
+private:
+  std::string body;
+  size_t pos;
+  size_t segment;
+};
+
+void report(const char* name, mock_source& src, size_t received, long segments, int ms, long allocs) {
+  if (received != src.size()) printf("%-10s short read: %zu of %zu bytes\n", name, received, src.size());
+  printf("%-10s %8ld segments %6d ms %10.1f MB/s %8.2f allocs/segment\n", name, segments, ms, src.size() / 1048576.0 * 1000.0 / (ms ? ms : 1), (double) allocs / segments);
+}
+
+int main(int argc, char** argv) {
+  size_t mb = 4, segment = 1460;
+  if (argc >= 2) mb = atoi(argv[1]);
+  if (argc >= 3) segment = atoi(argv[2]);
+  mock_source src(mb << 20, segment);
+
+  //Old loop: each segment comes in on a deferred std::future, the way the
+  //polyfill's callers produced them. It keeps a thread alive per segment,
+  //so it sits out runs that would need more than a few thousand.
+  const size_t MAX_LEGACY_SEGMENTS = 10000;
+  if (src.size() / segment > MAX_LEGACY_SEGMENTS) {
+    printf("%-10s skipped: %zu segments would need as many threads\n", "legacy", src.size() / segment);
+  } else {
+    std::string received;
+    long segments = 0;
+    auto before = allocations.load();
+    auto t = now();
+    legacy::do_while([&]() {
+      ++segments;
+      received += src.next();
+      return std::async(std::launch::deferred, [&]() { return !src.done(); });
+    }).wait();
+    report("legacy", src, received.size(), segments, to_milliseconds(t, now()), allocations.load() - before);
+  }
+
+  //Each segment completes on an "I/O" thread, like a recv finishing on the
+  //completion port
+  {
+    Pool io(1);
+    src.rewind();
+    std::string received;
+    long segments = 0;
+    auto before = allocations.load();
+    auto t = now();
+    auto f = cs477::do_while([&]() {
+      return io.submit([&]() { return src.next(); }).then([&](cs477::future<std::string> f) {
+        ++segments;
+        received += f.get();
+        return !src.done();
+      });
+    });
+    f.wait();
+    report("do_while", src, received.size(), segments, to_milliseconds(t, now()), allocations.load() - before);
+  }
+
+  //Everything already buffered: every future is ready on arrival, which is
+  //where a recursive loop would run out of stack
+  {
+    src.rewind();
+    std::string received;
+    long segments = 0;
+    auto before = allocations.load();
+    auto t = now();
+    cs477::do_while([&]() {
+      ++segments;
+      received += src.next();
+      return cs477::make_ready_future(!src.done());
+    }).get();
+    report("buffered", src, received.size(), segments, to_milliseconds(t, now()), allocations.load() - before);
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../lib/time.hpp"
+#include "../lib/pool.hpp"
+
+//Compares the pool the homeworks started with against both modes of the
+//current one (shared queue and work stealing) on the homework-2 (primes)
+//and homework-4 (merge sort) workloads.
+
+//The original Pool: one deque of deferred std::futures behind a mutex,
+//and a condition variable to sleep on. Kept as it was except where noted.
+namespace legacy {
+class Pool {
+private:
+  //Count of threads in the pool
+  int count;
+  //Mutex when performing actions on the non-thread-safe STL utilities
+  std::mutex m;
+  //Stuff for putting threads to sleepy sleepy
+  std::mutex m2;
+  std::condition_variable cv;
+  //List of our workers
+  std::vector<std::thread> threads;
+  //Whether or not we're accepting tasks
+  std::atomic<bool>* shutdown = new std::atomic<bool>(false);
+  //List of pending jobs waiting to be std::move'd by a worker
+  std::deque<std::future<void>> jobs;
+
+  void provision() {
+    //Lock while we create our threads (do you really think someone will try deleting us that fast? :sad_face:)
+    m.lock();
+    for (int i = 0; i < count; ++i) {
+      //Create a thread bound to the object which owns this pool object (because why not?)
+      threads.push_back(std::thread(&Pool::create_worker, this));
+    }
+    m.unlock();
+  }
+
+  void create_worker() {
+    for (;;) {
+      //Die if we're shutting down
+      if (shutdown->load()) break;
+      //Lock the mutex and check for work
+      m.lock();
+      if (jobs.empty()) {
+        //No work, go (back) to sleep! Changed: m2 is taken before m is let
+        //go, and shutdown checked under it. The original took m2 after, so
+        //a submit or the destructor could notify in between and the
+        //benchmark would hang.
+        std::unique_lock<std::mutex> lock(m2);
+        m.unlock();
+        if (!shutdown->load()) cv.wait(lock);
+      } else {
+        //Ermahgerd we have work! Leggo.
+        auto f = std::move(jobs.front());
+        jobs.pop_front();
+        m.unlock();
+
+        f.get();
+      }
+    }
+  }
+
+public:
+  Pool(const int& count) {
+    this->count = count;
+    provision();
+  }
+
+  ~Pool() {
+    //Signal shutdown to the workers
+    shutdown->store(true);
+    {
+      std::unique_lock<std::mutex> lock(m2);
+      cv.notify_all();
+    }
+    //Wait for all workers to finish current work
+    for (auto i = threads.begin(); i != threads.end(); ++i) i->join();
+    //Clean up our atomic variable
+    delete shutdown;
+  }
+
+  int size() const { return this->count; }
+
+  template <typename F, typename... A>
+  auto submit(F&& f, A&&... a) -> std::future<decltype(f(a...))> {
+    auto p = std::make_shared<std::packaged_task<decltype(f(a...))()>>(std::bind(std::forward<F>(f), std::forward<A>(a)...));
+    m.lock();
+    auto l = [p]() {
+      (*p)();
+    };
+    jobs.emplace_back(std::async(std::launch::deferred, std::move(l)));
+    m.unlock();
+    std::unique_lock<std::mutex> lock(m2);
+    cv.notify_one();
+    return p->get_future();
+  }
+};
+
+//Homework 4's sort as it was written against that pool: a job per half,
+//waited on with wait()
+template <class Iter>
+void merge_sort(Pool& pool, int forks, Iter start, Iter end) {
+  if (start >= end) return;
+  if (forks < 2) {
+    std::sort(start, end);
+  } else {
+    Iter mid = start + (end - start) / 2;
+    forks -= 2;
+    auto job1 = pool.submit([&]() {
+      merge_sort(pool, forks / 2, start, mid);
+    });
+    auto job2 = pool.submit([&]() {
+      merge_sort(pool, forks / 2, mid, end);
+    });
+    job1.wait();
+    job2.wait();
+    std::inplace_merge(start, mid, end);
+  }
+}
+}
+
+inline bool is_prime(const long& n) {
+  if (n <= 3) {
+    return n > 1;
+  } else if (n % 2 == 0 || n % 3 == 0) {
+    return false;
+  } else {
+    for (long i = 5; i * i <= n; i += 6) {
+      if (n % i == 0 || n % (i + 2) == 0) return false;
+    }
+  }
+  return true;
+}
+
+std::vector<long> get_primes(long start, long end) {
+  std::vector<long> v;
+  if (start <= 2 && end > 2) {
+    v.push_back(2);
+  }
+  if (start % 2 == 0) ++start;
+  for (long n = start; n < end; n += 2) {
+    if (is_prime(n)) v.push_back(n);
+  }
+  return v;
+}
+
+//Many small blocks so the queue (not the math) is what we are measuring
+template <typename P>
+size_t primes(P& pool, long compute_to, long per_block) {
+  std::vector<decltype(pool.submit(get_primes, 0L, 0L))> vs;
+  for (long c = 0; c < compute_to; c += per_block) {
+    vs.push_back(pool.submit(get_primes, c, std::min(c + per_block, compute_to)));
+  }
+  size_t found = 0;
+  for (auto v = vs.begin(); v != vs.end(); ++v) found += v->get().size();
+  return found;
+}
+
+template <class Iter>
+void merge_sort(Pool& pool, int forks, Iter start, Iter end) {
+  if (start >= end) return;
+  if (forks < 2) {
+    std::sort(start, end);
+  } else {
+    Iter mid = start + (end - start) / 2;
+    forks -= 2;
+    pool.invoke([&]() {
+      merge_sort(pool, forks / 2, start, mid);
+    }, [&]() {
+      merge_sort(pool, forks / 2, mid, end);
+    });
+    std::inplace_merge(start, mid, end);
+  }
+}
+
+//Best-of-runs milliseconds for both workloads on one pool
+template <typename P>
+bool measure(const char* name, P& pool, int runs, long compute_to, const std::vector<int>& input) {
+  int best_primes = -1, best_sort = -1;
+  for (int r = 0; r < runs; ++r) {
+    auto t = now();
+    primes(pool, compute_to, 2000);
+    auto ms = to_milliseconds(t, now());
+    if (best_primes < 0 || ms < best_primes) best_primes = ms;
+
+    auto v = input;
+    t = now();
+    merge_sort(pool, pool.size(), v.begin(), v.end());
+    ms = to_milliseconds(t, now());
+    if (best_sort < 0 || ms < best_sort) best_sort = ms;
+    if (!std::is_sorted(v.begin(), v.end())) {
+      puts("Not sorted?");
+      return false;
+    }
+  }
+  printf("%-14s %12d %12d\n", name, best_primes, best_sort);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const int THREADS = std::max(2u, std::thread::hardware_concurrency() * 2);
+  const int RUNS = 5;
+  long compute_to = 2000000;
+  int array_size = 4000000;
+  if (argc >= 2) compute_to = atol(argv[1]);
+  if (argc >= 3) array_size = atoi(argv[2]);
+
+  std::vector<int> input;
+  input.reserve(array_size);
+  srand(477);
+  for (int i = 0; i < array_size; ++i) input.push_back(rand());
+
+  printf("%d threads, best of %d runs.\n", THREADS, RUNS);
+  printf("%-14s %12s %12s\n", "pool", "primes ms", "sort ms");
+  {
+    legacy::Pool pool(THREADS);
+    if (!measure("baseline", pool, RUNS, compute_to, input)) return 1;
+  }
+  {
+    Pool pool(THREADS, pool_mode::shared);
+    if (!measure("shared", pool, RUNS, compute_to, input)) return 1;
+  }
+  {
+    Pool pool(THREADS, pool_mode::work_stealing);
+    if (!measure("work-stealing", pool, RUNS, compute_to, input)) return 1;
+  }
+  return 0;
+}
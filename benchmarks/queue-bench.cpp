@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "../lib/queue.hpp"
+
+//Throughput and push-to-pop latency of concurrent_queue (list + mutex +
+//notify_all) against cs477::mpmc_queue, for a few producer/consumer mixes,
+//and cs477::spsc_channel where there's just one of each.
+
+typedef std::chrono::steady_clock clock_type;
+
+struct item {
+  long value;
+  clock_type::time_point pushed;
+};
+
+//One in this many items has its latency recorded
+const long SAMPLE = 64;
+
+struct result {
+  double seconds;
+  std::vector<double> latencies;
+};
+
+//Both queues behind the same face: done() tells every consumer to stop
+struct locked_queue {
+  concurrent_queue<item> q;
+  int consumers;
+
+  explicit locked_queue(int consumers) : consumers(consumers) {}
+
+  void push(const item& i) {
+    q.push(i);
+  }
+
+  bool pop(item& i) {
+    i = q.pop();
+    return i.value >= 0;
+  }
+
+  void done() {
+    for (int c = 0; c < consumers; ++c) q.push(item{-1, clock_type::now()});
+  }
+};
+
+struct ring_queue {
+  cs477::mpmc_queue<item> q;
+
+  explicit ring_queue(int) : q(1024) {}
+
+  void push(const item& i) {
+    q.push(i);
+  }
+
+  bool pop(item& i) {
+    return q.pop(i);
+  }
+
+  void done() {
+    q.close();
+  }
+};
+
+//One producer, one consumer only
+struct channel_queue {
+  cs477::spsc_channel<item> q;
+
+  explicit channel_queue(int) : q(1024) {}
+
+  void push(const item& i) {
+    q.push(i);
+  }
+
+  bool pop(item& i) {
+    return q.pop(i);
+  }
+
+  void done() {
+    q.close();
+  }
+};
+
+template <typename Q>
+result run(int producers, int consumers, long items) {
+  Q q(consumers);
+  std::vector<std::vector<double>> seen(consumers);
+  std::vector<std::thread> threads;
+  auto start = clock_type::now();
+  for (int c = 0; c < consumers; ++c) {
+    threads.emplace_back([&q, &seen, c]() {
+      item i;
+      while (q.pop(i)) {
+        if (i.value % SAMPLE == 0) seen[c].push_back(std::chrono::duration<double, std::micro>(clock_type::now() - i.pushed).count());
+      }
+    });
+  }
+  std::vector<std::thread> pushers;
+  for (int p = 0; p < producers; ++p) {
+    pushers.emplace_back([&q, p, producers, items]() {
+      for (long v = p; v < items; v += producers) q.push(item{v, clock_type::now()});
+    });
+  }
+  for (auto& t : pushers) t.join();
+  q.done();
+  for (auto& t : threads) t.join();
+  result r;
+  r.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+  for (auto& s : seen) r.latencies.insert(r.latencies.end(), s.begin(), s.end());
+  std::sort(r.latencies.begin(), r.latencies.end());
+  return r;
+}
+
+void report(const char* name, int producers, int consumers, long items, const result& r) {
+  auto at = [&r](double q) { return r.latencies.empty() ? 0.0 : r.latencies[static_cast<size_t>(q * (r.latencies.size() - 1))]; };
+  printf("%-7s %2dP/%-2dC %12.0f items/s   latency p50 %8.1f us  p99 %8.1f us\n", name, producers, consumers, items / r.seconds, at(0.5), at(0.99));
+}
+
+int main(int argc, char** argv) {
+  long items = 2000000;
+  if (argc >= 2) items = atol(argv[1]);
+  const int mixes[][2] = {{1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1}};
+  for (auto& m : mixes) {
+    report("locked", m[0], m[1], items, run<locked_queue>(m[0], m[1], items));
+    report("mpmc", m[0], m[1], items, run<ring_queue>(m[0], m[1], items));
+    if (m[0] == 1 && m[1] == 1) report("spsc", 1, 1, items, run<channel_queue>(1, 1, items));
+  }
+  return 0;
+}
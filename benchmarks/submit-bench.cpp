@@ -0,0 +1,102 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include "../lib/time.hpp"
+#include "../lib/pool.hpp"
+#include "count-alloc.hpp"
+
+//Measures submits per second (and heap allocations per submit) for the
+//pool's task path against the packaged_task/std::async wrapping it replaced.
+
+//The submit path Pool used to have: a shared packaged_task, wrapped in a
+//lambda, wrapped in a deferred std::async, queued under a single mutex
+class legacy_pool {
+private:
+  std::mutex m;
+  std::condition_variable cv;
+  bool shutdown = false;
+  std::deque<std::future<void>> jobs;
+  std::vector<std::thread> threads;
+
+  void create_worker() {
+    for (;;) {
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [this]() { return shutdown || !jobs.empty(); });
+      if (jobs.empty()) break;
+      auto f = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      f.get();
+    }
+  }
+
+public:
+  legacy_pool(int count) {
+    for (int i = 0; i < count; ++i) threads.emplace_back(&legacy_pool::create_worker, this);
+  }
+
+  ~legacy_pool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      shutdown = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) t.join();
+  }
+
+  template <typename F>
+  auto submit(F&& f) -> std::future<decltype(f())> {
+    auto p = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+    auto l = [p]() {
+      (*p)();
+    };
+    {
+      std::lock_guard<std::mutex> lock(m);
+      jobs.emplace_back(std::async(std::launch::deferred, std::move(l)));
+    }
+    cv.notify_one();
+    return p->get_future();
+  }
+};
+
+template <typename P, typename Future>
+void run(const char* name, P& pool, int tasks) {
+  std::atomic<long> sum(0);
+  std::vector<Future> futures;
+  futures.reserve(tasks);
+  auto before = allocations.load();
+  auto t = now();
+  for (int i = 0; i < tasks; ++i) {
+    futures.push_back(pool.submit([&sum, i]() { sum += i; }));
+  }
+  for (auto& f : futures) f.wait();
+  auto ms = to_milliseconds(t, now());
+  auto allocs = allocations.load() - before;
+  printf("%-10s %10d tasks %8d ms %12.0f submits/s %6.2f allocs/task\n", name, tasks, ms, tasks * 1000.0 / (ms ? ms : 1), (double) allocs / tasks);
+}
+
+int main(int argc, char** argv) {
+  int tasks = 1000000;
+  if (argc >= 2) tasks = atoi(argv[1]);
+  const int THREADS = std::max(2u, std::thread::hardware_concurrency());
+  {
+    legacy_pool pool(THREADS);
+    run<legacy_pool, std::future<void>>("legacy", pool, tasks);
+  }
+  {
+    Pool pool(THREADS);
+    run<Pool, cs477::future<void>>("pool", pool, tasks);
+
+    //parallel_for chunks never allocate
+    const int CALLS = 10000;
+    std::vector<int> v(1024);
+    auto before = allocations.load();
+    auto t = now();
+    for (int i = 0; i < CALLS; ++i) {
+      pool.parallel_for(0, (int) v.size(), [&](int j) { v[j] += j; });
+    }
+    auto ms = to_milliseconds(t, now());
+    printf("%-10s %10d calls %8d ms %12.0f calls/s   %6.2f allocs/call\n", "par_for", CALLS, ms, CALLS * 1000.0 / (ms ? ms : 1), (double) (allocations.load() - before) / CALLS);
+  }
+  return 0;
+}
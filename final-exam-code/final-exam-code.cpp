@@ -4,11 +4,14 @@
 #include <thread>
 #include <mutex>
 #include <future>
+#include <array>
+#include <string>
+#include <functional>
 #include "../lib/matrix.hpp"
 #include "../lib/pool.hpp"
+#include "../lib/graph.hpp"
 #include "../lib/image.hpp"
-#include "../lib/promise-polyfill.hpp"
-#include "../lib/queue.hpp"
+#include "../lib/convolution.hpp"
 
 /* 1a */
 matrix operator*(const matrix &x, const matrix &y) {
@@ -16,42 +19,16 @@ matrix operator*(const matrix &x, const matrix &y) {
     throw std::invalid_argument("Invalid arguments");
   }
 
-  matrix z;
-  z.create(x.rows, y.cols);
-
-  //Flatten the loops so we can fairly chunk up the work (assume the
-  //picture isn't the same width as it is height!)
-  parallel_for(0u, x.rows * y.cols, [&](int k) {
-    unsigned i = k / y.cols, j = k % y.cols;
-    int zz = 0;
-    for (unsigned k = 0; k < x.cols; k++) {
-      zz += x(i, k) * y(k, j);
-    }
-    z(i, j) = zz;
-  });
-  return z;
+  //Packed, cache-blocked tiles, handed out to the pool's threads as they
+  //free up (see gemm.hpp)
+  return cs477::multiply(default_pool(), x, y);
 }
 
 /* 1b */
-matrix histogram(const matrix &x) {
-  std::mutex mutex;
-  matrix h{1, 256};
-  h.create(h.rows, h.cols);
-  parallel_for(0u, x.rows * x.cols, [&](int k) {
-    unsigned i = k / x.cols, j = k % x.cols;
-    auto value = x(i, j);
-    if (value <= 0) {
-      std::lock_guard<std::mutex> lock(mutex);
-      h(0, 0)++;
-    } else if (value >= 255) {
-      std::lock_guard<std::mutex> lock(mutex);
-      h(255, 0)++;
-    } else {
-      std::lock_guard<std::mutex> lock(mutex);
-      h(value, 0)++;
-    }
-  });
-  return h;
+//Any element type, and any view (a tile, say); see lib/convolution.hpp
+template <typename T>
+matrix histogram(const T &x) {
+  return cs477::histogram(default_pool(), x);
 }
 
 /*
@@ -111,104 +88,39 @@ int mainExFixed() {
 
 /* 4 completed */
 // CONV - START
-void conv(matrix &x, const matrix &k) {
-  matrix y;
-  y.create(x.rows + k.rows, x.cols + k.cols);
-
-  const unsigned xR = x.rows, xC = x.cols;
-  parallel_for(0u, xR * xC, [&](auto i) {
-    auto row = i % xR, col = i / xR;
-    auto yrow = row + k.rows / 2;
-    auto ycol = col + k.cols / 2;
-    y(yrow, ycol) = x(row, col);
-  });
-
-  std::atomic<int> weight(0);
-  const unsigned kR = k.rows, kC = k.cols;
-  parallel_for(0u, kR * kC, [&](int i) {
-    auto row = i % kR, col = i / kR;
-    weight += k(row, col);
-  });
-
-  parallel_for(0u, xR * xC, [&](int i) {
-    auto row = i % xR, col = i / xR;
-    int t = 0;
-    auto yrow = row;
-    for (int krow = k.rows - 1; krow >= 0; krow--, yrow++) {
-      auto ycol = col;
-      for (int kcol = k.cols - 1; kcol >= 0; kcol--, ycol++) {
-        t += y(yrow, ycol) * k(krow, kcol);
-      }
-    }
-    if (weight != 0) {
-      t /= weight;
-    }
-    x(row, col) = t;
-  });
+//The blur itself (zero-padded edges, views, any element type) lives in
+//lib/convolution.hpp, shared with homework 3
+template <typename T>
+void conv(basic_matrix<T> &x, const matrix &k) {
+  cs477::conv(default_pool(), x, k);
 }
 
-int binomial_coefficient(int n, int k) {
-  if (n <= 1 || k == 0) {
-    return 1;
-  } else {
-    return binomial_coefficient(n - 1, k - 1) * n / k;
-  }
-}
-
-matrix binomial(int n) {
-  if ((n & 1) == 0) {
-    throw std::invalid_argument("n must be odd");
-  }
-
-  matrix x, y;
-  x.create(1, n);
-  y.create(n, 1);
-
-  for (int i = 0; i < n / 2; i++) {
-    x(0, i) = x(0, n - i - 1) = binomial_coefficient(n - 1, i);
-    y(i, 0) = y(n - i - 1, 0) = binomial_coefficient(n - 1, i);
-  }
-
-  x(0, n / 2) = binomial_coefficient(n - 1, n / 2);
-  y(n / 2, 0) = binomial_coefficient(n - 1, n / 2);
-
-  return y * x;
-}
+using cs477::binomial;
 //CONV - END
 
-struct pipeline_container {
-  std::promise<matrix> p;
-  matrix m;
+//One image's trip through the pipeline; the graph's nodes fill it in
+struct blur_job {
+  std::string path;
+  byte_matrix image;
+  matrix kernel;
+  matrix hist;
 };
 
-concurrent_queue<std::shared_ptr<pipeline_container>> pipeline;
-
-std::future<matrix> blur_image_async(matrix x) {
-  std::shared_ptr<pipeline_container> c = std::make_shared<pipeline_container>();
-  c->m = std::move(x);
-  pipeline.push(c);
-  return c->p.get_future();
-}
-
 int main_q4() {
-  auto pipeline_thread = std::thread([] {
-    matrix kernel = binomial(3);
-    for (;;) {
-      auto s = pipeline.pop();
-      conv(s->m, kernel);
-      s->p.set_value(std::move(s->m));
-    }
-  });
-
-  Promise::then(load_image_async("image.png").share(), [](auto f) {
-    Promise::then(blur_image_async(f.get()).share(), [](auto f) {
-      matrix h = histogram(f.get());
-    });
-  });
-
-  pipeline_thread.join();
+  //Built once and run per image. Loading the picture and building the
+  //kernel don't depend on each other, so they run side by side.
+  cs477::graph<blur_job> pipeline;
+  auto load = pipeline.add([](blur_job &j) { j.image = load_image<uint8_t>(j.path); });
+  auto kernel = pipeline.add([](blur_job &j) { j.kernel = binomial(3); });
+  auto blur = pipeline.add([](blur_job &j) { conv(j.image, j.kernel); }, {load, kernel});
+  pipeline.add([](blur_job &j) { j.hist = histogram(j.image); }, {blur});
+
+  blur_job job;
+  job.path = "image.png";
+  pipeline.run_and_wait(job);
   return 0;
 }
+
 /* 4 end */
 
 /*
@@ -1,6 +1,8 @@
 #include "../lib/pool.hpp"
+#include "../lib/bench.hpp"
 #include <cstdio>
 #include <cstdlib>
+#include <string>
 
 inline bool is_prime(const long& n) {
   if (n <= 3) {
@@ -27,30 +29,57 @@ std::vector<long> get_primes(long start, long end) {
   return v;
 }
 
-int main(int argc, char** argv) {
-  long compute_to = 1000000;
-  if (argc == 2) compute_to = atoi(argv[1]);
-
-  Pool pool;
+//Splits [0, compute_to) into one block per worker and gathers the primes
+std::vector<long> primes_under(Pool& pool, long compute_to, bool verbose) {
   const int POOL_SIZE = pool.size();
-  printf("Using a pool size of %d to compute primes under %d.\n", POOL_SIZE, compute_to);
-
   const long PER_BLOCK = compute_to / POOL_SIZE;
   const long ADDL = compute_to - PER_BLOCK * POOL_SIZE;
   long c = 0;
-  std::vector<std::future<std::vector<long>>> vs;
+  std::vector<cs477::future<std::vector<long>>> vs;
   for (int i = 0; i < POOL_SIZE; ++i) {
     long start = c;
     c += PER_BLOCK + (i < ADDL ? 1 : 0);
     long end = c;
-    printf("Thread %d from %d to %d.\n", i, start, end);
+    if (verbose) printf("Thread %d from %d to %d.\n", i, start, end);
     vs.push_back(pool.submit(get_primes, start, end));
   }
+  //Each block's primes land in its own slot as soon as that block is done
+  std::vector<std::vector<long>> blocks(POOL_SIZE);
+  auto all = cs477::when_all(vs.begin(), vs.end(), blocks.begin());
+  pool.get(all);
+  size_t total = 0;
+  for (auto& b : blocks) total += b.size();
   std::vector<long> primes;
-  for (auto v = vs.begin(); v != vs.end(); ++v) {
-    std::vector<long> sub = v->get();
-    primes.insert(std::end(primes), std::begin(sub), std::end(sub));
+  primes.reserve(total);
+  for (auto& b : blocks) primes.insert(std::end(primes), std::begin(b), std::end(b));
+  return primes;
+}
+
+int run_benchmarks(const cs477::bench_options& options) {
+  Pool pool;
+  cs477::bench b(options);
+  for (long n : {100000L, 1000000L, 10000000L}) {
+    b.run("primes pool " + std::to_string(n), [&]() {
+      cs477::do_not_optimize(primes_under(pool, n, false));
+    }).items = n;
   }
+  b.run("primes serial 1000000", []() {
+    cs477::do_not_optimize(get_primes(0, 1000000));
+  }).items = 1000000;
+  b.report();
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  auto options = cs477::bench_options::from_args(argc, argv);
+  if (options.enabled) return run_benchmarks(options);
+
+  long compute_to = 1000000;
+  if (argc == 2) compute_to = atoi(argv[1]);
+
+  Pool pool;
+  printf("Using a pool size of %d to compute primes under %d.\n", pool.size(), compute_to);
+  auto primes = primes_under(pool, compute_to, true);
   printf("There are %d primes under %d.\n", primes.size(), compute_to);
   return 0;
 }
@@ -2,76 +2,51 @@
 #include "../lib/image.hpp"
 #include "../lib/time.hpp"
 #include "../lib/pool.hpp"
-#include <atomic>
-
-void conv(Pool &pool, matrix &x, const matrix &k) {
-  matrix y;
-  y.create(x.rows + k.rows, x.cols + k.cols);
-
-  const unsigned xR = x.rows, xC = x.cols;
-  pool.parallel_for(0u, xR * xC, [&](auto i) {
-    auto row = i % xR, col = i / xR;
-    auto yrow = row + k.rows / 2;
-    auto ycol = col + k.cols / 2;
-    y(yrow, ycol) = x(row, col);
-  });
-
-  std::atomic<int> weight(0);
-  const unsigned kR = k.rows, kC = k.cols;
-  pool.parallel_for(0u, kR * kC, [&](int i) {
-    auto row = i % kR, col = i / kR;
-    weight += k(row, col);
-  });
-
-  pool.parallel_for(0u, xR * xC, [&](int i) {
-    auto row = i % xR, col = i / xR;
-    int t = 0;
-    auto yrow = row;
-    for (int krow = k.rows - 1; krow >= 0; krow--, yrow++) {
-      auto ycol = col;
-      for (int kcol = k.cols - 1; kcol >= 0; kcol--, ycol++) {
-        t += y(yrow, ycol) * k(krow, kcol);
-      }
-    }
-    if (weight != 0) {
-      t /= weight;
-    }
-    x(row, col) = t;
-  });
+#include "../lib/bench.hpp"
+#include "../lib/trace.hpp"
+#include "../lib/convolution.hpp"
+#include <string>
+#include <functional>
+
+using cs477::binomial;
+using cs477::conv;
+
+//Blurs an image with an n x n kernel into a second one, so every run starts
+//from the original
+template <typename T>
+void bench_conv(cs477::bench &b, Pool &pool, const basic_matrix<T> &orig, int n, const char *type) {
+  auto kernel = binomial(n);
+  basic_matrix<T> bmp;
+  bmp.create(orig.rows, orig.cols);
+  auto &r = b.run("conv " + std::to_string(n) + "x" + std::to_string(n) + " " + type, [&]() { conv(pool, orig.view(), bmp.view(), kernel); });
+  r.items = static_cast<double>(orig.rows) * orig.cols;
+  r.bytes = r.items * sizeof(T);
 }
 
-int binomial_coefficient(int n, int k) {
-  if (n <= 1 || k == 0) {
-    return 1;
-  } else {
-    return binomial_coefficient(n - 1, k - 1) * n / k;
+//Byte images against the same picture widened to int
+int run_benchmarks(Pool &pool, const byte_matrix &orig, const cs477::bench_options &options) {
+  cs477::bench b(options);
+  auto wide = matrix_cast<int>(orig);
+  for (int n : {3, 9, 15}) {
+    bench_conv(b, pool, orig, n, "uint8");
+    bench_conv(b, pool, wide, n, "int");
   }
-}
-
-matrix binomial(int n) {
-  if ((n & 1) == 0) {
-    throw std::invalid_argument("n must be odd");
-  }
-
-  matrix x, y;
-  x.create(1, n);
-  y.create(n, 1);
-
-  for (int i = 0; i < n / 2; i++) {
-    x(0, i) = x(0, n - i - 1) = binomial_coefficient(n - 1, i);
-    y(i, 0) = y(n - i - 1, 0) = binomial_coefficient(n - 1, i);
-  }
-
-  x(0, n / 2) = binomial_coefficient(n - 1, n / 2);
-  y(n / 2, 0) = binomial_coefficient(n - 1, n / 2);
-
-  return y * x;
+  b.report();
+  return 0;
 }
 
 int main(int argc, char **argv) {
-  auto bmp = load_image("test.png");
+  TRACE_ONLY(cs477::trace::name_thread("main"));
+  //One byte per pixel, as the PNG has it
+  auto bmp = load_image<uint8_t>("test.png");
   auto orig = bmp;
 
+  auto options = cs477::bench_options::from_args(argc, argv);
+  if (options.enabled) {
+    Pool pool;
+    return run_benchmarks(pool, orig, options);
+  }
+
   //If the program crashes, try decreasing this number (it's senstive to [large] image size).
   matrix kernel = binomial(9);
 
@@ -81,5 +56,7 @@ int main(int argc, char **argv) {
   printf("Blurred in %d ms.\n", to_milliseconds(start, now()));
 
   save_png(bmp, "output.png");
+  //Built with TRACING: open this in chrome://tracing
+  TRACE_ONLY(cs477::trace::save("trace.json"));
   return 0;
 }
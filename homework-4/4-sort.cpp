@@ -5,40 +5,64 @@
 #include <thread>
 #include <cstdio>
 #include <cmath>
+#include <string>
 #include "../lib/time.hpp"
 #include "../lib/pool.hpp"
+#include "../lib/bench.hpp"
 
+//Sorts [start, end) with up to `forks` leaves. Nothing waits: each merge is
+//queued as soon as both of its halves are sorted, so merging near the bottom
+//starts while other leaves are still sorting.
 template <class Iter>
-void merge_sort(std::atomic<int> &threads, Pool &pool, int forks, const Iter &start, const Iter &end) {
-  if (start >= end) return;
-  if (forks < 2) {
-    std::sort(start, end);
-  } else {
-    Iter mid = start + (end - start) / 2;
-    threads += 2;
-    forks -= 2;
-    auto job1 = pool.submit([&]() {
-      merge_sort(threads, pool, forks / 2, start, mid);
-    });
-    auto job2 = pool.submit([&]() {
-      merge_sort(threads, pool, forks / 2, mid, end);
-    });
-    job1.wait();
-    job2.wait();
-    std::inplace_merge(start, mid, end);
+cs477::future<void> merge_sort(std::atomic<int> &threads, Pool &pool, int forks, Iter start, Iter end) {
+  if (forks < 2 || end - start < 2) {
+    threads++;
+    return pool.submit([start, end]() { std::sort(start, end); });
   }
+  Iter mid = start + (end - start) / 2;
+  cs477::future<void> halves[] = {merge_sort(threads, pool, forks / 2, start, mid), merge_sort(threads, pool, forks / 2, mid, end)};
+  return cs477::when_all(std::begin(halves), std::end(halves)).then(pool, [start, mid, end](cs477::future<void> f) {
+    f.get();
+    std::inplace_merge(start, mid, end);
+  });
 }
 
 template <class Iter>
 void merge_sort(Pool &pool, const Iter &start, const Iter &end) {
   std::atomic<int> spawned(0);
-  merge_sort(spawned, pool, pool.size(), start, end);
+  auto done = merge_sort(spawned, pool, pool.size(), start, end);
+  pool.get(done);
   printf("%d threads were actually spawned (this only plays nice when threads is 2^n).\n", spawned.load());
 }
 
+//Sorts freshly shuffled arrays of a few sizes; refilling is off the clock
+int run_benchmarks(Pool &pool, const cs477::bench_options &options) {
+  cs477::bench b(options);
+  std::vector<int> v;
+  for (int n : {100000, 1000000, 10000000}) {
+    auto fill = [&v, n]() {
+      v.clear();
+      for (int i = 0; i < n; ++i) v.push_back(rand());
+    };
+    b.run("merge_sort " + std::to_string(n), fill, [&]() {
+      std::atomic<int> spawned(0);
+      auto done = merge_sort(spawned, pool, pool.size(), v.begin(), v.end());
+      pool.get(done);
+    }).items = n;
+    b.run("std::sort " + std::to_string(n), fill, [&]() { std::sort(v.begin(), v.end()); }).items = n;
+  }
+  b.report();
+  return 0;
+}
+
 int main(int argc, char **argv) {
-  Pool pool(std::thread::hardware_concurrency() * 2);
+  //One worker per core: no worker ever blocks waiting on another, so more
+  //threads would only oversubscribe the machine
+  pool_options options;
+  Pool pool(options);
   srand(time(nullptr));
+  auto bench_options = cs477::bench_options::from_args(argc, argv);
+  if (bench_options.enabled) return run_benchmarks(pool, bench_options);
   int array_size = 10000000;
   puts("Filling ...");
   std::vector<int> v;
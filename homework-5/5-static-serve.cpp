@@ -1,8 +1,9 @@
 #include "../lib/network.hpp"
 #include "../lib/http.hpp"
-#include "../lib/promise-polyfill.hpp"
 #include <cstdio>
 #include "../lib/file.hpp"
+#include "../lib/task.hpp"
+#include "../lib/bench.hpp"
 
 #define PATH_DISABLED false
 
@@ -32,9 +33,10 @@ cs477::net::http_response make_response(int status, const std::string &content,
   return rsp;
 }
 
+//Every step continues on the I/O thread that finished the previous one, so a
+//connection only occupies a thread while there is something to do for it
 void socket_handler(cs477::net::socket sock) {
-  auto f = cs477::net::read_http_request_async(sock).share();
-  Promise::then(f, [sock](auto s) {
+  cs477::net::read_http_request_async(sock).then([sock](cs477::future<cs477::net::http_request> s) {
     auto rq = s.get();
     std::string path = rq.url;
     auto pos = path.find("/");
@@ -54,7 +56,7 @@ void socket_handler(cs477::net::socket sock) {
         cs477::net::write_http_response_async(sock, make_response(404, "File not found.", "text/plain"));
       } else {
         try {
-          Promise::then(read_file_async(path.c_str()).share(), [sock](auto f) {
+          read_file_async(path.c_str()).then([sock](cs477::future<std::string> f) {
             auto s = f.get();
             cs477::net::write_http_response_async(sock, make_response(200, s, "text/plain"));
           });
@@ -68,14 +70,71 @@ void socket_handler(cs477::net::socket sock) {
   });
 }
 
+#ifdef CS477_HAS_COROUTINES
+//The same handler as a coroutine: it reads top to bottom, and the whole
+//request lives in one coroutine frame instead of a chain of callbacks
+cs477::task<void> serve(cs477::net::socket sock) {
+  std::string body;
+  bool found = false;
+  try {
+    auto rq = co_await cs477::net::read_http_request_async(sock);
+    auto pos = rq.url.find("/");
+    if (pos != std::string::npos && pos + 1 < rq.url.length()) {
+      body = co_await read_file_async(rq.url.substr(pos + 1).c_str());
+      found = true;
+    }
+  } catch (...) {
+  }
+  try {
+    if (found) {
+      co_await cs477::net::write_http_response_async(sock, make_response(200, body, "text/plain"));
+    } else {
+      co_await cs477::net::write_http_response_async(sock, make_response(404, "File not found.", "text/plain"));
+    }
+  } catch (...) {
+  }
+}
+#endif
+
+//The CPU side of a request, without the network: parsing a typical GET and
+//formatting the response to it
+int run_benchmarks(const cs477::bench_options &options) {
+  cs477::bench b(options);
+  const std::string request = "GET /index.html HTTP/1.1\r\n"
+                              "Host: localhost:8080\r\n"
+                              "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64)\r\n"
+                              "Accept: text/html,application/xhtml+xml\r\n"
+                              "Accept-Encoding: gzip, deflate\r\n"
+                              "Connection: keep-alive\r\n\r\n";
+  auto &parse = b.run("http parse", [&]() {
+    cs477::do_not_optimize(cs477::net::read_http_request(request.data(), static_cast<uint32_t>(request.size())));
+  });
+  parse.items = 1;
+  parse.bytes = static_cast<double>(request.size());
+
+  auto rsp = make_response(200, std::string(4096, 'x'), "text/plain");
+  auto &format = b.run("http format 4 KB", [&]() { cs477::do_not_optimize(cs477::net::write_http_response(rsp)); });
+  format.items = 1;
+  format.bytes = static_cast<double>(rsp.body.size());
+  b.report();
+  return 0;
+}
+
 int main(int argc, char **argv) {
+  auto options = cs477::bench_options::from_args(argc, argv);
+  if (options.enabled) return run_benchmarks(options);
+
   cs477::net::initialize();
   auto addr = cs477::net::resolve_address("localhost", 8080);
   auto host = std::make_shared<cs477::net::acceptor>();
   host->listen(addr);
 
   for (int i = 0; i < 32; i++) {
+#ifdef CS477_HAS_COROUTINES
+    host->accept_async([](cs477::net::socket sock) { cs477::spawn(serve(std::move(sock))); });
+#else
     host->accept_async(socket_handler);
+#endif
   }
 
   std::promise<void> p;
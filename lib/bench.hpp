@@ -0,0 +1,336 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "counters.hpp"
+
+namespace cs477 {
+
+// Keeps the compiler from optimizing away a result nobody looks at
+template <typename T>
+inline void do_not_optimize(const T &value) {
+#ifdef _MSC_VER
+  const volatile void *volatile sink = &value;
+  (void)sink;
+  _ReadWriteBarrier();
+#else
+  asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+enum class bench_format { table, csv, json };
+
+// How to run benchmarks; from_args() reads them off a program's command line:
+//   --bench  --warmup=N  --repeats=N  --min-sample-ms=N  --csv  --json
+//   --counters
+struct bench_options {
+  bool enabled = false;
+  // Untimed runs first, to fault pages in and warm caches and the pool
+  int warmup = 1;
+  // Timed samples; the statistics are over these
+  int repeats = 10;
+  // Bodies quicker than this are run several times per sample (when there's
+  // no per-run setup), so short ones still get a meaningful reading
+  double min_sample_ms = 1;
+  bench_format format = bench_format::table;
+  // Hardware counters (cycles, IPC, cache and TLB misses) for every thread
+  // while the samples run, where the machine has them
+  bool counters = false;
+
+  static bench_options from_args(int argc, char **argv) {
+    bench_options o;
+    for (int i = 1; i < argc; ++i) {
+      auto arg = argv[i];
+      auto value = std::strchr(arg, '=');
+      if (!std::strcmp(arg, "--bench")) {
+        o.enabled = true;
+      } else if (!std::strcmp(arg, "--csv")) {
+        o.format = bench_format::csv;
+      } else if (!std::strcmp(arg, "--json")) {
+        o.format = bench_format::json;
+      } else if (!std::strcmp(arg, "--counters")) {
+        o.counters = true;
+      } else if (value && !std::strncmp(arg, "--warmup=", 9)) {
+        o.warmup = std::max(0, std::atoi(value + 1));
+      } else if (value && !std::strncmp(arg, "--repeats=", 10)) {
+        o.repeats = std::max(1, std::atoi(value + 1));
+      } else if (value && !std::strncmp(arg, "--min-sample-ms=", 16)) {
+        o.min_sample_ms = std::atof(value + 1);
+      }
+    }
+    return o;
+  }
+};
+
+// Statistics for one benchmark, in nanoseconds per run of the body
+struct bench_result {
+  std::string name;
+  int samples = 0;
+  // Body runs per sample
+  long long batch = 1;
+  double min = 0, median = 0, p99 = 0, mean = 0, stddev = 0;
+  // Work done by one run of the body, for the throughput columns (0: none)
+  double items = 0, bytes = 0;
+  // Hardware counts per run of the body (with --counters)
+  counter_sample counters;
+
+  double items_per_second() const {
+    return median > 0 ? items * 1e9 / median : 0;
+  }
+
+  double bytes_per_second() const {
+    return median > 0 ? bytes * 1e9 / median : 0;
+  }
+};
+
+// Runs bodies a few times each and reports how long they took:
+//
+//   cs477::bench b(cs477::bench_options::from_args(argc, argv));
+//   b.run("primes 1e6", [&]() { count_primes(1000000); }).items = 1000000;
+//   b.report();
+//
+// Times come from steady_clock at nanosecond resolution. Each sample is timed
+// on its own, so the min, median, p99 and standard deviation show how noisy
+// the measurement is as well as how fast the code is. With --counters the
+// report adds hardware counts per run, e.g. to tell a memory-bound kernel
+// (low IPC, many cache misses) from a compute-bound one.
+class bench {
+public:
+  explicit bench(bench_options options = bench_options()) : options(options) {}
+
+  // Times body()
+  template <typename Body>
+  bench_result &run(const std::string &name, Body body) {
+    for (int i = 0; i < options.warmup; ++i) body();
+    // Calibrate: how many runs make a sample long enough to time reliably
+    long long batch = 1;
+    auto once = time([&]() { body(); });
+    if (once > 0 && once < options.min_sample_ms * 1e6) batch = static_cast<long long>(options.min_sample_ms * 1e6 / once) + 1;
+    auto counters = open_counters();
+    std::vector<double> samples;
+    for (int i = 0; i < options.repeats; ++i) {
+      if (counters) counters->start();
+      samples.push_back(time([&]() {
+        for (long long j = 0; j < batch; ++j) body();
+      }) / batch);
+      if (counters) counters->stop();
+    }
+    return record(name, batch, samples, counters.get());
+  }
+
+  // Times body() only; setup() runs before each of them, off the clock (to
+  // reshuffle an array that body() sorts, say)
+  template <typename Setup, typename Body>
+  bench_result &run(const std::string &name, Setup setup, Body body) {
+    for (int i = 0; i < options.warmup; ++i) {
+      setup();
+      body();
+    }
+    auto counters = open_counters();
+    std::vector<double> samples;
+    for (int i = 0; i < options.repeats; ++i) {
+      setup();
+      if (counters) counters->start();
+      samples.push_back(time(body));
+      if (counters) counters->stop();
+    }
+    return record(name, 1, samples, counters.get());
+  }
+
+  const std::deque<bench_result> &results() const {
+    return all;
+  }
+
+  // Prints every result in the format the options asked for
+  void report(FILE *out = stdout) const {
+    switch (options.format) {
+    case bench_format::table:
+      print_table(out);
+      break;
+    case bench_format::csv:
+      print_csv(out);
+      break;
+    case bench_format::json:
+      print_json(out);
+      break;
+    }
+  }
+
+  void print_table(FILE *out) const {
+    fprintf(out, "%-28s %7s %10s %10s %10s %10s %9s %12s %12s\n", "benchmark", "samples", "min", "median", "p99", "mean", "stddev%", "items/s", "bytes/s");
+    for (auto &r : all) {
+      fprintf(out, "%-28s %7d %10s %10s %10s %10s %8.1f%% %12s %12s\n", r.name.c_str(), r.samples, duration(r.min).c_str(), duration(r.median).c_str(), duration(r.p99).c_str(), duration(r.mean).c_str(),
+              r.mean > 0 ? r.stddev * 100 / r.mean : 0.0, rate(r.items_per_second(), "").c_str(), rate(r.bytes_per_second(), "B").c_str());
+    }
+    if (!options.counters) return;
+    bool any = false;
+    for (auto &r : all) any = any || !r.counters.empty();
+    if (!any) {
+      fprintf(out, "(no hardware counters on this machine)\n");
+      return;
+    }
+    fprintf(out, "\n%-28s %6s", "per run", "IPC");
+    for (int i = 0; i < hw_counter_count; ++i) fprintf(out, " %13s", to_string(static_cast<hw_counter>(i)));
+    fprintf(out, "\n");
+    for (auto &r : all) {
+      fprintf(out, "%-28s %6s", r.name.c_str(), r.counters.ipc() > 0 ? fixed(r.counters.ipc()).c_str() : "-");
+      for (int i = 0; i < hw_counter_count; ++i) fprintf(out, " %13s", r.counters.valid[i] ? count(r.counters.values[i]).c_str() : "-");
+      fprintf(out, "\n");
+    }
+  }
+
+  void print_csv(FILE *out) const {
+    fprintf(out, "name,samples,batch,min_ns,median_ns,p99_ns,mean_ns,stddev_ns,items_per_s,bytes_per_s");
+    if (options.counters) {
+      for (int i = 0; i < hw_counter_count; ++i) fprintf(out, ",%s", to_string(static_cast<hw_counter>(i)));
+    }
+    fprintf(out, "\n");
+    for (auto &r : all) {
+      fprintf(out, "\"%s\",%d,%lld,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f", escaped(r.name, '"').c_str(), r.samples, r.batch, r.min, r.median, r.p99, r.mean, r.stddev, r.items_per_second(), r.bytes_per_second());
+      // Counters the machine doesn't have are left empty
+      for (int i = 0; options.counters && i < hw_counter_count; ++i) {
+        if (r.counters.valid[i]) {
+          fprintf(out, ",%.1f", r.counters.values[i]);
+        } else {
+          fprintf(out, ",");
+        }
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  void print_json(FILE *out) const {
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < all.size(); ++i) {
+      auto &r = all[i];
+      fprintf(out, "  {\"name\": \"%s\", \"samples\": %d, \"batch\": %lld, \"min_ns\": %.1f, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, \"items_per_s\": %.1f, \"bytes_per_s\": %.1f",
+              escaped(r.name, '\\').c_str(), r.samples, r.batch, r.min, r.median, r.p99, r.mean, r.stddev, r.items_per_second(), r.bytes_per_second());
+      if (options.counters) {
+        // Only the counters the machine has
+        fprintf(out, ", \"counters\": {");
+        const char *sep = "";
+        for (int c = 0; c < hw_counter_count; ++c) {
+          if (!r.counters.valid[c]) continue;
+          fprintf(out, "%s\"%s\": %.1f", sep, to_string(static_cast<hw_counter>(c)), r.counters.values[c]);
+          sep = ", ";
+        }
+        fprintf(out, "}");
+      }
+      fprintf(out, "}%s\n", i + 1 < all.size() ? "," : "");
+    }
+    fprintf(out, "]\n");
+  }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  template <typename F>
+  static double time(F &&f) {
+    auto start = clock::now();
+    f();
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+  }
+
+  // Counts every thread that exists when the benchmark starts, so work a
+  // pool's workers do is included
+  std::unique_ptr<counter_group> open_counters() const {
+    if (!options.counters) return nullptr;
+    return std::unique_ptr<counter_group>(new counter_group(
+        counter_scope::process, {hw_counter::cycles, hw_counter::instructions, hw_counter::cache_misses, hw_counter::branch_misses, hw_counter::llc_misses, hw_counter::dtlb_misses}));
+  }
+
+  bench_result &record(const std::string &name, long long batch, std::vector<double> samples, const counter_group *counters) {
+    std::sort(samples.begin(), samples.end());
+    bench_result r;
+    r.name = name;
+    r.batch = batch;
+    r.samples = static_cast<int>(samples.size());
+    r.min = samples.front();
+    auto n = samples.size();
+    r.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    // Nearest rank
+    r.p99 = samples[static_cast<size_t>(std::ceil(0.99 * n)) - 1];
+    double sum = 0;
+    for (auto s : samples) sum += s;
+    r.mean = sum / n;
+    double sq = 0;
+    for (auto s : samples) sq += (s - r.mean) * (s - r.mean);
+    r.stddev = n > 1 ? std::sqrt(sq / (n - 1)) : 0;
+    if (counters) {
+      r.counters = counters->read();
+      r.counters /= static_cast<double>(n * batch);
+    }
+    all.push_back(r);
+    return all.back();
+  }
+
+  static std::string duration(double ns) {
+    char text[32];
+    if (ns < 1e3) {
+      snprintf(text, sizeof(text), "%.0f ns", ns);
+    } else if (ns < 1e6) {
+      snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+    } else if (ns < 1e9) {
+      snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+    } else {
+      snprintf(text, sizeof(text), "%.2f s", ns / 1e9);
+    }
+    return text;
+  }
+
+  static std::string fixed(double x) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", x);
+    return text;
+  }
+
+  // 1234567 -> "1.23 M"
+  static std::string count(double n) {
+    const char *prefixes[] = {"", "K", "M", "G", "T"};
+    int p = 0;
+    while (n >= 1000 && p < 4) {
+      n /= 1000;
+      ++p;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), p ? "%.2f %s" : "%.0f%s", n, prefixes[p]);
+    return text;
+  }
+
+  static std::string rate(double per_second, const char *unit) {
+    if (per_second <= 0) return "-";
+    return count(per_second) + unit;
+  }
+
+  // Escapes quotes (and, for JSON, backslashes) in a name
+  static std::string escaped(const std::string &s, char escape) {
+    std::string out;
+    for (auto c : s) {
+      if (c == '"' || (escape == '\\' && c == '\\')) out += escape;
+      out += c;
+    }
+    return out;
+  }
+
+  bench_options options;
+  // A deque, so the reference run() hands back stays good
+  std::deque<bench_result> all;
+};
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef CANCEL_HPP
+#define CANCEL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+namespace cs477 {
+
+// Thrown (or stored in a future) when work is given up on
+class operation_cancelled : public std::runtime_error {
+public:
+  operation_cancelled() : std::runtime_error("operation cancelled") {}
+};
+
+namespace details {
+struct cancel_state {
+  std::atomic<bool> cancelled{false};
+  bool has_deadline = false;
+  std::chrono::steady_clock::time_point deadline;
+  // A token made with until() also fires with the one it came from
+  std::shared_ptr<cancel_state> parent;
+
+  bool check() {
+    if (cancelled.load(std::memory_order_relaxed)) return true;
+    if ((has_deadline && std::chrono::steady_clock::now() >= deadline) || (parent && parent->check())) {
+      // Latch it so later checks are a single load
+      cancelled.store(true, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+};
+}
+
+// Something a task can poll to find out nobody wants its result anymore.
+// Tokens are cheap to copy; a default-constructed one never fires, and
+// checking it is a null test.
+class cancel_token {
+public:
+  cancel_token() {}
+
+  bool cancelled() const {
+    return s && s->check();
+  }
+
+  void throw_if_cancelled() const {
+    if (cancelled()) throw operation_cancelled();
+  }
+
+  // A token that fires with this one or at `deadline`, whichever is first
+  cancel_token until(std::chrono::steady_clock::time_point deadline) const {
+    auto d = std::make_shared<details::cancel_state>();
+    d->has_deadline = true;
+    d->deadline = deadline;
+    d->parent = s;
+    return cancel_token(std::move(d));
+  }
+
+  template <typename Rep, typename Period>
+  cancel_token after(std::chrono::duration<Rep, Period> timeout) const {
+    return until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+  }
+
+private:
+  friend class cancel_source;
+  explicit cancel_token(std::shared_ptr<details::cancel_state> s) : s(std::move(s)) {}
+
+  std::shared_ptr<details::cancel_state> s;
+};
+
+// Hands out tokens and fires them all with cancel()
+class cancel_source {
+public:
+  cancel_source() : s(std::make_shared<details::cancel_state>()) {}
+
+  cancel_token token() const {
+    return cancel_token(s);
+  }
+
+  void cancel() {
+    s->cancelled.store(true, std::memory_order_relaxed);
+  }
+
+  bool cancelled() const {
+    return s->cancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::shared_ptr<details::cancel_state> s;
+};
+}
+
+#endif
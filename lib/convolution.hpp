@@ -0,0 +1,133 @@
+#ifndef CONVOLUTION_HPP
+#define CONVOLUTION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include "matrix.hpp"
+#include "pool.hpp"
+#include "trace.hpp"
+
+namespace cs477 {
+
+// Blurs x into out (the same size, and not overlapping it) on `pool`.
+// Either can be part of a bigger matrix, e.g. one tile of an image, and the
+// element types may differ (results are clamped into out's). Pixels past the
+// edges count as zeros: the kernel is cut short there, so nothing is copied
+// into a padded border first. Byte images are a quarter of the memory
+// traffic of int ones.
+template <typename In, typename T>
+void conv(Pool &pool, matrix_view<In> x, matrix_view<T> out, const matrix &k) {
+  if (x.rows != out.rows || x.cols != out.cols) {
+    throw std::invalid_argument("Invalid arguments");
+  }
+
+  const int xR = x.rows, xC = x.cols;
+  const int kR = k.rows, kC = k.cols;
+  // Where the kernel's last row and column land, relative to the output pixel
+  const int hR = kR - 1 - kR / 2, hC = kC - 1 - kC / 2;
+  // A kernel is a few hundred ints at most, cheaper to sum than to hand out
+  const int weight = std::accumulate(k.data, k.data + kR * kC, 0);
+
+  // Edge rows do less work than the middle ones, hence dynamic scheduling
+  TRACE_SPAN("conv blur");
+  pool.parallel_for_range(0, xR, [&](int r0, int r1) {
+    for (auto row = r0; row < r1; ++row) {
+      // Kernel rows that land inside x
+      const int klo = std::max(0, row + hR - (xR - 1)), khi = std::min(kR - 1, row + hR);
+      auto dst = out.row_data(row);
+      for (int col = 0; col < xC; ++col) {
+        const int kclo = std::max(0, col + hC - (xC - 1)), kchi = std::min(kC - 1, col + hC);
+        int t = 0;
+        for (int krow = khi; krow >= klo; krow--) {
+          auto src = x.row_data(row + hR - krow) + col + hC;
+          auto kk = k.data + krow * kC;
+          for (int kcol = kchi; kcol >= kclo; kcol--) {
+            t += src[-kcol] * kk[kcol];
+          }
+        }
+        if (weight != 0) {
+          t /= weight;
+        }
+        dst[col] = saturate_cast<typename matrix_view<T>::value_type>(t);
+      }
+    }
+  }, schedule::dynamic);
+}
+
+// In place: the blur has to read the original pixels, so it works from a
+// copy of them
+template <typename T>
+void conv(Pool &pool, basic_matrix<T> &x, const matrix &k) {
+  const basic_matrix<T> y = [&]() {
+    TRACE_SPAN("conv copy");
+    return x;
+  }();
+  conv(pool, y.view(), x.view(), k);
+}
+
+inline int binomial_coefficient(int n, int k) {
+  if (n <= 1 || k == 0) {
+    return 1;
+  } else {
+    return binomial_coefficient(n - 1, k - 1) * n / k;
+  }
+}
+
+// An n x n binomial (Gaussian-like) blur kernel; n must be odd
+inline matrix binomial(int n) {
+  if ((n & 1) == 0) {
+    throw std::invalid_argument("n must be odd");
+  }
+
+  matrix x, y;
+  x.create(1, n);
+  y.create(n, 1);
+
+  for (int i = 0; i < n / 2; i++) {
+    x(0, i) = x(0, n - i - 1) = binomial_coefficient(n - 1, i);
+    y(i, 0) = y(n - i - 1, 0) = binomial_coefficient(n - 1, i);
+  }
+
+  x(0, n / 2) = binomial_coefficient(n - 1, n / 2);
+  y(n / 2, 0) = binomial_coefficient(n - 1, n / 2);
+
+  return multiply(y, x);
+}
+
+// Counts of each gray level in x (any element type, any view) as a 256 x 1
+// matrix; values outside 0..255 land in the end bins
+template <typename T>
+matrix histogram(Pool &pool, matrix_view<T> x) {
+  matrix h{1, 256};
+  h.create(h.rows, h.cols);
+  // Every thread counts into its own bins; they are only summed at the end
+  combinable<std::array<int, 256>> bins(pool, std::array<int, 256>{});
+  // Split by element, not by row, so a short wide view still spreads out
+  const size_t cols = x.cols;
+  if (!cols) return h;
+  pool.parallel_for_range(size_t(0), x.rows * cols, [&](size_t i, size_t end) {
+    auto &local = bins.local();
+    for (auto row = i / cols; i < end; ++row) {
+      auto ptr = x.row_data(static_cast<unsigned>(row));
+      for (auto col = i - row * cols; col < cols && i < end; ++col, ++i) {
+        local[saturate_cast<uint8_t>(ptr[col])]++;
+      }
+    }
+  });
+  bins.combine_each([&](const std::array<int, 256> &local) {
+    for (int i = 0; i < 256; i++) h(i, 0) += local[i];
+  });
+  return h;
+}
+
+template <typename T>
+matrix histogram(Pool &pool, const basic_matrix<T> &x) {
+  return histogram(pool, x.view());
+}
+}
+
+#endif
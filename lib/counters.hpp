@@ -0,0 +1,274 @@
+#ifndef COUNTERS_HPP
+#define COUNTERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+namespace cs477 {
+
+// Hardware events a counter_group can count
+enum class hw_counter {
+  cycles,
+  instructions,
+  // Whatever the CPU calls a cache miss (usually last-level references that
+  // went to memory)
+  cache_misses,
+  branch_misses,
+  // Last-level cache read misses
+  llc_misses,
+  // Data TLB read misses
+  dtlb_misses,
+};
+
+const int hw_counter_count = 6;
+
+inline const char *to_string(hw_counter c) {
+  static const char *names[] = {"cycles", "instructions", "cache-misses", "branch-misses", "llc-misses", "dtlb-misses"};
+  return names[static_cast<int>(c)];
+}
+
+// Counts from a counter_group. Counters the machine wouldn't give us are
+// missing (has() is false) rather than zero.
+struct counter_sample {
+  double values[hw_counter_count] = {};
+  bool valid[hw_counter_count] = {};
+
+  bool has(hw_counter c) const {
+    return valid[static_cast<int>(c)];
+  }
+
+  double operator[](hw_counter c) const {
+    return values[static_cast<int>(c)];
+  }
+
+  bool empty() const {
+    for (auto v : valid) {
+      if (v) return false;
+    }
+    return true;
+  }
+
+  // Instructions per cycle: under 1 or so usually means waiting on memory
+  double ipc() const {
+    return has(hw_counter::cycles) && has(hw_counter::instructions) && (*this)[hw_counter::cycles] > 0 ? (*this)[hw_counter::instructions] / (*this)[hw_counter::cycles] : 0;
+  }
+
+  // Adds up counts from several threads or regions
+  counter_sample &operator+=(const counter_sample &x) {
+    for (int i = 0; i < hw_counter_count; ++i) {
+      values[i] += x.values[i];
+      valid[i] = valid[i] || x.valid[i];
+    }
+    return *this;
+  }
+
+  // Per run, per item, ...
+  counter_sample &operator/=(double n) {
+    for (auto &v : values) v /= n;
+    return *this;
+  }
+};
+
+// Who a counter_group counts
+enum class counter_scope {
+  // The thread that made the group, and threads it starts afterwards
+  thread,
+  // Every thread of the process alive when the group is made (a pool's
+  // workers, say)
+  process,
+};
+
+// A set of hardware counters read through perf_event_open (Linux only):
+//
+//   cs477::counter_group counters;
+//   {
+//     cs477::counting c(counters);
+//     conv(pool, bmp, kernel);
+//   }
+//   printf("IPC %.2f\n", counters.read().ipc());
+//
+// Counters start and stop together, so their ratios describe the same
+// stretch of work. Anything the kernel won't give us (no PMU in a VM,
+// perf_event_paranoid, a seccomp filter in a container, another OS) is left
+// out of read(), and a group with nothing in it is still safe to use; set
+// CS477_NO_COUNTERS in the environment to get one on purpose. Counts only
+// include user-mode work.
+class counter_group {
+public:
+  explicit counter_group(counter_scope scope = counter_scope::thread, std::initializer_list<hw_counter> which = {hw_counter::cycles, hw_counter::instructions, hw_counter::cache_misses, hw_counter::branch_misses}) {
+#if defined(__linux__)
+    if (std::getenv("CS477_NO_COUNTERS")) return;
+    if (scope == counter_scope::thread) {
+      open_thread(0, true, which);
+    } else if (auto dir = opendir("/proc/self/task")) {
+      while (auto entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') open_thread(std::atoi(entry->d_name), false, which);
+      }
+      closedir(dir);
+    }
+#else
+    (void)scope;
+    (void)which;
+#endif
+  }
+
+  counter_group(const counter_group &) = delete;
+  counter_group &operator=(const counter_group &) = delete;
+
+  ~counter_group() {
+#if defined(__linux__)
+    for (auto &e : events) close(e.fd);
+#endif
+  }
+
+  // True if at least one counter could be opened
+  bool available() const {
+    return !events.empty();
+  }
+
+  // Counts accumulate over every start()/stop() pair until reset()
+  void start() {
+    control(enable);
+  }
+
+  void stop() {
+    control(disable);
+  }
+
+  void reset() {
+    control(zero);
+  }
+
+  // Totals so far, summed over threads. A counter the kernel had to share
+  // with other events is scaled up to the whole time it was enabled.
+  counter_sample read() const {
+    counter_sample s;
+#if defined(__linux__)
+    for (auto &e : events) {
+      uint64_t v[3];
+      if (::read(e.fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) continue;
+      auto i = static_cast<int>(e.which);
+      s.values[i] += static_cast<double>(v[0]) * (static_cast<double>(v[1]) / static_cast<double>(v[2]));
+      s.valid[i] = true;
+    }
+#endif
+    return s;
+  }
+
+private:
+  enum op { enable, disable, zero };
+
+  struct event {
+    int fd;
+    hw_counter which;
+    // Leads its own group (others follow it on enable/disable)
+    bool leader;
+  };
+
+  void control(op o) {
+#if defined(__linux__)
+    static const unsigned long requests[] = {PERF_EVENT_IOC_ENABLE, PERF_EVENT_IOC_DISABLE, PERF_EVENT_IOC_RESET};
+    for (auto &e : events) {
+      if (e.leader) ioctl(e.fd, requests[o], PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)o;
+#endif
+  }
+
+#if defined(__linux__)
+  static bool describe(hw_counter c, perf_event_attr &attr) {
+    auto cache = [](uint64_t which) { return which | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); };
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (c) {
+    case hw_counter::cycles:
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      return true;
+    case hw_counter::instructions:
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      return true;
+    case hw_counter::cache_misses:
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      return true;
+    case hw_counter::branch_misses:
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      return true;
+    case hw_counter::llc_misses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = cache(PERF_COUNT_HW_CACHE_LL);
+      return true;
+    case hw_counter::dtlb_misses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = cache(PERF_COUNT_HW_CACHE_DTLB);
+      return true;
+    }
+    return false;
+  }
+
+  static int open_event(hw_counter c, int tid, bool inherit, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (!describe(c, attr)) return -1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Members follow their leader; leaders wait for start()
+    attr.disabled = group < 0;
+    attr.inherit = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, group, 0));
+  }
+
+  // One group per thread. An event the PMU can't fit into the group (or
+  // that doesn't exist on this CPU) is tried on its own, then dropped.
+  void open_thread(int tid, bool inherit, std::initializer_list<hw_counter> which) {
+    int leader = -1;
+    for (auto c : which) {
+      auto fd = open_event(c, tid, inherit, leader);
+      bool leads = leader < 0;
+      if (fd < 0 && leader >= 0) {
+        fd = open_event(c, tid, inherit, -1);
+        leads = true;
+      }
+      if (fd < 0) continue;
+      if (leader < 0) leader = fd;
+      events.push_back(event{fd, c, leads});
+    }
+  }
+#endif
+
+  std::vector<event> events;
+};
+
+// Counts while in scope
+class counting {
+public:
+  explicit counting(counter_group &group) : group(group) {
+    group.start();
+  }
+
+  ~counting() {
+    group.stop();
+  }
+
+  counting(const counting &) = delete;
+  counting &operator=(const counting &) = delete;
+
+private:
+  counter_group &group;
+};
+}
+
+#endif
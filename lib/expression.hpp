@@ -0,0 +1,323 @@
+#ifndef EXPRESSION_HPP
+#define EXPRESSION_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "matrix.hpp"
+
+// Elementwise matrix arithmetic is lazy: a + b - c * 2 builds a small tree
+// of nodes that refer to a, b and c, and nothing is computed until the tree
+// is stored into a matrix. Then every element is worked out in one pass,
+// straight into the destination, with no temporaries in between:
+//
+//   matrix d = a + b - c * 2;   // one loop over d
+//   d += a - b;                 // one loop, d updated in place
+//
+// Operands must hold the same element type (a compile error otherwise; use
+// matrix_cast) and the same number of rows and columns (checked when the
+// tree is built; std::invalid_argument otherwise). Nodes refer to the
+// matrices they were built from, and take temporaries over, so `auto e = a +
+// b` is only good as long as a and b are; store it into a matrix to keep it.
+// Views work the same way, and assign() stores a tree into one:
+//
+//   image.tile(0, 0, 64, 64).assign(a.tile(0, 0, 64, 64) * 2);
+
+namespace cs477 {
+namespace details {
+
+template <typename T>
+struct plus {
+  T operator()(T x, T y) const {
+    return static_cast<T>(x + y);
+  }
+};
+
+template <typename T>
+struct minus {
+  T operator()(T x, T y) const {
+    return static_cast<T>(x - y);
+  }
+};
+
+template <typename T>
+struct multiplies {
+  T operator()(T x, T y) const {
+    return static_cast<T>(x * y);
+  }
+};
+
+template <typename T>
+struct divides {
+  T operator()(T x, T y) const {
+    return static_cast<T>(x / y);
+  }
+};
+
+// Nodes are evaluated a row at a time: row(r) hands back something cheap to
+// index by column, so the evaluation loop keeps plain pointers in registers
+// (and the compiler can vectorize it) instead of reloading them through the
+// tree for every element.
+
+// A matrix in a tree: by reference for lvalues, moved in for temporaries
+template <typename M, bool Owns>
+class leaf {
+public:
+  typedef typename M::value_type value_type;
+  typedef std::true_type expression_tag;
+
+  explicit leaf(const M &m) : m(m) {}
+
+  unsigned rows() const {
+    return m.rows;
+  }
+
+  unsigned cols() const {
+    return m.cols;
+  }
+
+  const value_type *row(unsigned r) const {
+    return m.data + static_cast<size_t>(r) * m.cols;
+  }
+
+private:
+  typename std::conditional<Owns, M, const M &>::type m;
+};
+
+// A view in a tree, held by value (it is only a pointer and a shape)
+template <typename T>
+class view_leaf {
+public:
+  typedef T value_type;
+  typedef std::true_type expression_tag;
+
+  explicit view_leaf(matrix_view<const T> v) : v(v) {}
+
+  unsigned rows() const {
+    return v.rows;
+  }
+
+  unsigned cols() const {
+    return v.cols;
+  }
+
+  const T *row(unsigned r) const {
+    return v.row_data(r);
+  }
+
+private:
+  matrix_view<const T> v;
+};
+
+template <typename Op, typename L, typename R>
+class binary {
+public:
+  typedef typename L::value_type value_type;
+  typedef std::true_type expression_tag;
+  static_assert(std::is_same<value_type, typename R::value_type>::value, "matrix elements must be the same type (see matrix_cast)");
+
+  binary(L l, R r) : l(std::move(l)), r(std::move(r)) {
+    if (this->l.rows() != this->r.rows() || this->l.cols() != this->r.cols()) {
+      throw std::invalid_argument("Invalid arguments");
+    }
+  }
+
+  unsigned rows() const {
+    return l.rows();
+  }
+
+  unsigned cols() const {
+    return l.cols();
+  }
+
+  struct row_type {
+    typename std::decay<decltype(std::declval<L>().row(0))>::type l;
+    typename std::decay<decltype(std::declval<R>().row(0))>::type r;
+
+    value_type operator[](unsigned c) const {
+      return Op()(l[c], r[c]);
+    }
+  };
+
+  row_type row(unsigned i) const {
+    return row_type{l.row(i), r.row(i)};
+  }
+
+private:
+  L l;
+  R r;
+};
+
+// x op s for every element x, or s op x with Flipped
+template <typename Op, typename E, bool Flipped>
+class scalar {
+public:
+  typedef typename E::value_type value_type;
+  typedef std::true_type expression_tag;
+
+  scalar(E e, value_type s) : e(std::move(e)), s(s) {}
+
+  unsigned rows() const {
+    return e.rows();
+  }
+
+  unsigned cols() const {
+    return e.cols();
+  }
+
+  struct row_type {
+    typename std::decay<decltype(std::declval<E>().row(0))>::type e;
+    value_type s;
+
+    value_type operator[](unsigned c) const {
+      return Flipped ? Op()(s, e[c]) : Op()(e[c], s);
+    }
+  };
+
+  row_type row(unsigned i) const {
+    return row_type{e.row(i), s};
+  }
+
+private:
+  E e;
+  value_type s;
+};
+
+template <typename X, typename = void>
+struct is_expression : std::false_type {};
+
+template <typename X>
+struct is_expression<X, typename std::enable_if<std::decay<X>::type::expression_tag::value>::type> : std::true_type {};
+
+template <typename X>
+struct is_matrix : std::false_type {};
+
+template <typename T>
+struct is_matrix<basic_matrix<T>> : std::true_type {};
+
+template <typename X>
+struct is_view : std::false_type {};
+
+template <typename T>
+struct is_view<matrix_view<T>> : std::true_type {};
+
+// What an operand is stored as in a tree
+template <typename X, typename D = typename std::decay<X>::type, bool = is_matrix<D>::value, bool = is_view<D>::value>
+struct node {
+  typedef D type;
+};
+
+template <typename X, typename D>
+struct node<X, D, true, false> {
+  typedef leaf<D, !std::is_lvalue_reference<X>::value> type;
+};
+
+template <typename X, typename D>
+struct node<X, D, false, true> {
+  typedef view_leaf<typename D::value_type> type;
+};
+
+template <typename X>
+using node_t = typename node<X>::type;
+
+template <typename X>
+struct is_operand : std::integral_constant<bool, is_expression<X>::value || is_matrix<typename std::decay<X>::type>::value || is_view<typename std::decay<X>::type>::value> {};
+
+// x op y where neither is a plain number, and at least one is already a tree
+// (a matrix times a matrix is a matrix product, not elementwise; see
+// cs477::multiply for views)
+template <typename X, typename Y>
+struct lazy_pair : std::integral_constant<bool, is_operand<X>::value && is_operand<Y>::value && (is_expression<X>::value || is_expression<Y>::value)> {};
+
+template <typename X, typename S>
+struct with_scalar : std::integral_constant<bool, is_operand<X>::value && std::is_arithmetic<S>::value> {};
+
+// What a matrix product reads an operand through: matrices and views as
+// they are, trees worked out into `tmp` first
+template <typename T>
+matrix_view<const T> product_view(const basic_matrix<T> &m, basic_matrix<T> &) {
+  return m.view();
+}
+
+template <typename T, typename U>
+matrix_view<const T> product_view(matrix_view<U> v, basic_matrix<T> &) {
+  return v;
+}
+
+template <typename T, typename E, typename = typename std::enable_if<is_expression<E>::value>::type>
+matrix_view<const T> product_view(const E &e, basic_matrix<T> &tmp) {
+  tmp = basic_matrix<T>(e);
+  return tmp.view();
+}
+
+template <typename Op, typename X, typename Y>
+using binary_t = binary<Op, node_t<X>, node_t<Y>>;
+
+template <template <typename> class Op, typename X, bool Flipped>
+using scalar_t = scalar<Op<typename node_t<X>::value_type>, node_t<X>, Flipped>;
+}
+}
+
+// x + y and x - y for matrices, views (or trees of them), elementwise
+template <typename X, typename Y, typename = typename std::enable_if<cs477::details::is_operand<X>::value && cs477::details::is_operand<Y>::value>::type>
+cs477::details::binary_t<cs477::details::plus<typename cs477::details::node_t<X>::value_type>, X, Y> operator+(X &&x, Y &&y) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), cs477::details::node_t<Y>(std::forward<Y>(y))};
+}
+
+template <typename X, typename Y, typename = typename std::enable_if<cs477::details::is_operand<X>::value && cs477::details::is_operand<Y>::value>::type>
+cs477::details::binary_t<cs477::details::minus<typename cs477::details::node_t<X>::value_type>, X, Y> operator-(X &&x, Y &&y) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), cs477::details::node_t<Y>(std::forward<Y>(y))};
+}
+
+template <typename X, typename = typename std::enable_if<cs477::details::is_operand<X>::value>::type>
+cs477::details::scalar_t<cs477::details::minus, X, true> operator-(X &&x) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), 0};
+}
+
+// With a number on either side: x + 1, 2 * x, x / 4, ... The number is
+// converted to the element type first, as with x += s.
+template <typename X, typename S, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::plus, X, false> operator+(X &&x, S s) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename S, typename X, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::plus, X, true> operator+(S s, X &&x) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename X, typename S, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::minus, X, false> operator-(X &&x, S s) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename S, typename X, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::minus, X, true> operator-(S s, X &&x) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename X, typename S, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::multiplies, X, false> operator*(X &&x, S s) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename S, typename X, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::multiplies, X, true> operator*(S s, X &&x) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+template <typename X, typename S, typename = typename std::enable_if<cs477::details::with_scalar<X, S>::value>::type>
+cs477::details::scalar_t<cs477::details::divides, X, false> operator/(X &&x, S s) {
+  return {cs477::details::node_t<X>(std::forward<X>(x)), static_cast<typename cs477::details::node_t<X>::value_type>(s)};
+}
+
+// A matrix product with a tree on either side works out the tree first; a
+// matrix or view on the other side is read where it is, not copied
+template <typename X, typename Y, typename = typename std::enable_if<cs477::details::lazy_pair<X, Y>::value>::type>
+basic_matrix<typename cs477::details::node_t<X>::value_type> operator*(X &&x, Y &&y) {
+  basic_matrix<typename cs477::details::node_t<X>::value_type> xs, ys;
+  return cs477::multiply(cs477::details::product_view(x, xs), cs477::details::product_view(y, ys));
+}
+
+#endif
@@ -8,8 +8,12 @@
 #include <future>
 #include <string>
 #include <windows.h>
+#include "future.hpp"
+#include "trace.hpp"
 
-std::future<std::string> read_file_async(const char *path) {
+// Reads a whole file with overlapped I/O; the future is completed (and its
+// continuations run) on the thread pool's I/O thread
+inline cs477::future<std::string> read_file_async(const char *path) {
   HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
   if (file == INVALID_HANDLE_VALUE) {
     throw std::system_error(GetLastError(), std::system_category());
@@ -17,19 +21,21 @@ std::future<std::string> read_file_async(const char *path) {
 
   auto size = GetFileSize(file, nullptr);
   if (size < 1) {
-    std::promise<std::string> p;
-    p.set_value("");
-    return p.get_future();
+    CloseHandle(file);
+    return cs477::make_ready_future(std::string());
   }
 
   struct param_t {
     OVERLAPPED ol;
+    HANDLE file;
     std::string str;
-    std::promise<std::string> p;
+    cs477::promise<std::string> p;
+    TRACE_ONLY(uint64_t started = cs477::trace::ticks();)
   };
 
   auto param = new param_t;
   memset(&param->ol, 0, sizeof(OVERLAPPED));
+  param->file = file;
 
   param->str.resize(size);
 
@@ -38,18 +44,21 @@ std::future<std::string> read_file_async(const char *path) {
   auto io = CreateThreadpoolIo(file, [](PTP_CALLBACK_INSTANCE, PVOID, PVOID Overlapped, ULONG IoResult, ULONG_PTR, PTP_IO Io) {
     auto param = (param_t *) Overlapped;
 
+    TRACE_ONLY(cs477::trace::complete("file read", param->started, "bytes", static_cast<int64_t>(param->str.size())));
+    CloseThreadpoolIo(Io);
+    CloseHandle(param->file);
     if (IoResult) {
-      param->p.set_exception(std::make_exception_ptr(std::system_error(GetLastError(), std::system_category())));
+      param->p.set_exception(std::make_exception_ptr(std::system_error(IoResult, std::system_category())));
     } else {
       param->p.set_value(std::move(param->str));
     }
-
     delete param;
-    CloseThreadpoolIo(Io);
   }, nullptr, nullptr);
 
   if (!io) {
     param->p.set_exception(std::make_exception_ptr(std::system_error(GetLastError(), std::system_category())));
+    CloseHandle(file);
+    delete param;
     return f;
   }
 
@@ -60,7 +69,9 @@ std::future<std::string> read_file_async(const char *path) {
     if (err != ERROR_IO_PENDING) {
       CancelThreadpoolIo(io);
       CloseThreadpoolIo(io);
-      param->p.set_exception(std::make_exception_ptr(std::system_error(GetLastError(), std::system_category())));
+      CloseHandle(file);
+      param->p.set_exception(std::make_exception_ptr(std::system_error(err, std::system_category())));
+      delete param;
     }
   }
 
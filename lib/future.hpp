@@ -0,0 +1,684 @@
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "job.hpp"
+
+namespace cs477 {
+
+template <typename T>
+class future;
+
+template <typename T>
+class promise;
+
+// Runs continuations on whichever thread finishes the future
+struct inline_executor {
+  template <typename F>
+  void post(F &&f) {
+    f();
+  }
+};
+
+namespace details {
+
+// Intrusive reference to a shared state; the state deletes itself when the
+// last reference goes away.
+template <typename S>
+class ref {
+public:
+  ref() : p(nullptr) {}
+  // Adopts a reference the caller already owns.
+  explicit ref(S *p) : p(p) {}
+  ref(const ref &x) : p(x.p) {
+    if (p) p->addref();
+  }
+  ref(ref &&x) noexcept : p(x.p) {
+    x.p = nullptr;
+  }
+  ref &operator=(ref x) noexcept {
+    std::swap(p, x.p);
+    return *this;
+  }
+  ~ref() {
+    if (p) p->release();
+  }
+
+  S *operator->() const { return p; }
+  S &operator*() const { return *p; }
+  S *get() const { return p; }
+  explicit operator bool() const { return p != nullptr; }
+
+  void reset() {
+    if (p) p->release();
+    p = nullptr;
+  }
+
+private:
+  S *p;
+};
+
+class state_base {
+public:
+  state_base() : refs(1), ready(false), satisfied(false) {}
+  virtual ~state_base() {}
+
+  state_base(const state_base &) = delete;
+  state_base &operator=(const state_base &) = delete;
+
+  void addref() {
+    refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  // Only the first caller gets to fulfill the state.
+  bool claim() {
+    return !satisfied.exchange(true);
+  }
+
+  bool is_ready() const {
+    return ready.load(std::memory_order_acquire);
+  }
+
+  void wait() {
+    if (is_ready()) return;
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this]() { return ready.load(std::memory_order_relaxed); });
+  }
+
+  // Runs fn once the state is ready: right away if it already is, otherwise
+  // on the thread that makes it ready. Continuations run in the order they
+  // were added.
+  void on_ready(job fn) {
+    if (!defer(fn)) fn();
+  }
+
+  // Keeps fn to run when the state becomes ready; false (leaving fn alone)
+  // if it already is
+  bool defer(job &fn) {
+    std::lock_guard<std::mutex> lock(m);
+    if (ready.load(std::memory_order_relaxed)) return false;
+    if (!continuation) {
+      continuation = std::move(fn);
+    } else {
+      more.push_back(std::move(fn));
+    }
+    return true;
+  }
+
+  void set_exception(std::exception_ptr e) {
+    error = std::move(e);
+    mark_ready();
+  }
+
+protected:
+  void mark_ready() {
+    job next;
+    std::vector<job> rest;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      ready.store(true, std::memory_order_release);
+      next = std::move(continuation);
+      rest.swap(more);
+    }
+    cv.notify_all();
+    if (next) next();
+    for (auto &j : rest) j();
+  }
+
+  void rethrow() {
+    if (error) std::rethrow_exception(error);
+  }
+
+private:
+  std::atomic<int> refs;
+  std::atomic<bool> ready;
+  std::atomic<bool> satisfied;
+  std::mutex m;
+  std::condition_variable cv;
+  std::exception_ptr error;
+  // The first continuation; any more (when_any() and then() on the same
+  // future, say) wait in `more`, so the usual single one needs no vector
+  job continuation;
+  std::vector<job> more;
+};
+
+template <typename T>
+class state : public state_base {
+public:
+  state() : has_value(false) {}
+
+  ~state() {
+    if (has_value) value()->~T();
+  }
+
+  template <typename... A>
+  void set_value(A &&... a) {
+    new (&storage) T(std::forward<A>(a)...);
+    has_value = true;
+    mark_ready();
+  }
+
+  T take() {
+    wait();
+    rethrow();
+    return std::move(*value());
+  }
+
+private:
+  T *value() { return reinterpret_cast<T *>(&storage); }
+
+  bool has_value;
+  std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+};
+
+template <>
+class state<void> : public state_base {
+public:
+  void set_value() {
+    mark_ready();
+  }
+
+  void take() {
+    wait();
+    rethrow();
+  }
+};
+
+template <typename R, typename F>
+void invoke_into(state<R> &s, F &f) {
+  try {
+    s.set_value(f());
+  } catch (...) {
+    s.set_exception(std::current_exception());
+  }
+}
+
+template <typename F>
+void invoke_into(state<void> &s, F &f) {
+  try {
+    f();
+    s.set_value();
+  } catch (...) {
+    s.set_exception(std::current_exception());
+  }
+}
+
+// A state that produces its own value by running `fn`; the callable and the
+// result share one allocation.
+template <typename R, typename F>
+class task_state : public state<R> {
+public:
+  template <typename G>
+  explicit task_state(G &&g) : fn(std::forward<G>(g)) {}
+
+  void run() {
+    if (this->claim()) invoke_into(*this, fn);
+  }
+
+  void abandon() {
+    abandon(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+  }
+
+  void abandon(std::exception_ptr e) {
+    if (this->claim()) this->set_exception(std::move(e));
+  }
+
+private:
+  F fn;
+};
+
+// The queued half of a task_state: runs it once, or breaks the promise if it
+// is thrown away unrun.
+template <typename S>
+class run_task {
+public:
+  explicit run_task(ref<S> s) : s(std::move(s)) {}
+  run_task(run_task &&) noexcept = default;
+
+  ~run_task() {
+    if (s) s->abandon();
+  }
+
+  void operator()() {
+    auto p = std::move(s);
+    p->run();
+  }
+
+  // Settles the task with `e` instead of running it
+  void cancel(std::exception_ptr e) {
+    auto p = std::move(s);
+    p->abandon(std::move(e));
+  }
+
+private:
+  ref<S> s;
+};
+
+// What then() hands back for a continuation returning R: a future<R>, or
+// just the inner future when R is itself a future
+template <typename R>
+struct unwrap {
+  typedef R type;
+};
+
+template <typename U>
+struct unwrap<future<U>> {
+  typedef U type;
+};
+}
+
+template <typename T>
+class future {
+public:
+  future() {}
+  explicit future(details::ref<details::state<T>> s) : s(std::move(s)) {}
+
+  future(future &&) noexcept = default;
+  future &operator=(future &&) noexcept = default;
+
+  future(const future &) = delete;
+  future &operator=(const future &) = delete;
+
+  bool valid() const {
+    return static_cast<bool>(s);
+  }
+
+  bool is_ready() const {
+    check();
+    return s->is_ready();
+  }
+
+  void wait() const {
+    check();
+    s->wait();
+  }
+
+  T get() {
+    check();
+    auto p = std::move(s);
+    return p->take();
+  }
+
+  // Has fn() called (on the thread that completes this future) once it is
+  // ready and returns true; returns false without calling fn if it already
+  // is. The future stays valid either way. For awaiters and combinators.
+  template <typename F>
+  bool when_ready(F &&fn) {
+    check();
+    job j(std::forward<F>(fn));
+    return s->defer(j);
+  }
+
+  // Calls fn(future<T>) once this one is ready, on the thread that makes it
+  // ready, without anybody waiting. Returns a future for fn's result; if fn
+  // returns a future itself, for that future's result. Leaves this future
+  // empty.
+  template <typename F>
+  auto then(F &&fn) -> future<typename details::unwrap<std::result_of_t<std::decay_t<F> &(future<T>)>>::type> {
+    static inline_executor now;
+    return then(now, std::forward<F>(fn));
+  }
+
+  // then() for when nobody needs fn's result: fn(future<T>) just runs once
+  // this is ready, without a second shared state. fn shouldn't throw. Leaves
+  // this future empty.
+  template <typename F>
+  void on_ready(F &&fn) {
+    check();
+    auto state = s.get();
+    state->on_ready([s = std::move(s), fn = std::decay_t<F>(std::forward<F>(fn))]() mutable {
+      fn(future<T>(std::move(s)));
+    });
+  }
+
+  // then(), but fn is handed to ex.post() (a Pool, say) instead of running
+  // on the thread that finished this future. ex must outlive the wait.
+  template <typename Executor, typename F>
+  auto then(Executor &ex, F &&fn) -> future<typename details::unwrap<std::result_of_t<std::decay_t<F> &(future<T>)>>::type>;
+
+private:
+  void check() const {
+    if (!s) throw std::future_error(std::future_errc::no_state);
+  }
+
+  details::ref<details::state<T>> s;
+};
+
+template <typename T>
+class promise {
+public:
+  promise() : s(new details::state<T>), retrieved(false) {}
+
+  promise(promise &&) noexcept = default;
+
+  // Like destroying this promise first: a state it never satisfied is broken
+  promise &operator=(promise &&x) noexcept {
+    if (this != &x) {
+      abandon();
+      s = std::move(x.s);
+      retrieved = x.retrieved;
+    }
+    return *this;
+  }
+
+  promise(const promise &) = delete;
+  promise &operator=(const promise &) = delete;
+
+  ~promise() {
+    abandon();
+  }
+
+  future<T> get_future() {
+    if (retrieved) throw std::future_error(std::future_errc::future_already_retrieved);
+    retrieved = true;
+    return future<T>(s);
+  }
+
+  template <typename... A>
+  void set_value(A &&... a) {
+    claim();
+    s->set_value(std::forward<A>(a)...);
+  }
+
+  void set_exception(std::exception_ptr e) {
+    claim();
+    s->set_exception(std::move(e));
+  }
+
+private:
+  void abandon() {
+    if (s && s->claim()) s->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+  }
+
+  void claim() {
+    if (!s) throw std::future_error(std::future_errc::no_state);
+    if (!s->claim()) throw std::future_error(std::future_errc::promise_already_satisfied);
+  }
+
+  details::ref<details::state<T>> s;
+  bool retrieved;
+};
+
+namespace details {
+template <typename U>
+void forward_value(promise<U> &p, future<U> &f) {
+  p.set_value(f.get());
+}
+
+inline void forward_value(promise<void> &p, future<void> &f) {
+  f.get();
+  p.set_value();
+}
+
+// Settles p with whatever f(arg) produces (or throws)
+template <typename U, typename F, typename A>
+void fulfill(promise<U> &p, F &f, A &&arg, std::false_type /* returns a future */) {
+  try {
+    p.set_value(f(std::forward<A>(arg)));
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+template <typename F, typename A>
+void fulfill(promise<void> &p, F &f, A &&arg, std::false_type) {
+  try {
+    f(std::forward<A>(arg));
+    p.set_value();
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+template <typename U, typename F, typename A>
+void fulfill(promise<U> &p, F &f, A &&arg, std::true_type) {
+  future<U> inner;
+  try {
+    inner = f(std::forward<A>(arg));
+    if (!inner.valid()) throw std::future_error(std::future_errc::no_state);
+  } catch (...) {
+    p.set_exception(std::current_exception());
+    return;
+  }
+  inner.then([p = std::move(p)](future<U> inner) mutable {
+    try {
+      forward_value(p, inner);
+    } catch (...) {
+      p.set_exception(std::current_exception());
+    }
+  });
+}
+}
+
+template <typename T>
+template <typename Executor, typename F>
+auto future<T>::then(Executor &ex, F &&fn) -> future<typename details::unwrap<std::result_of_t<std::decay_t<F> &(future<T>)>>::type> {
+  using R = std::result_of_t<std::decay_t<F> &(future<T>)>;
+  using U = typename details::unwrap<R>::type;
+  using returns_future = std::integral_constant<bool, !std::is_same<R, U>::value>;
+  check();
+  promise<U> p;
+  auto result = p.get_future();
+  auto state = s.get();
+  state->on_ready([&ex, s = std::move(s), p = std::move(p), fn = std::decay_t<F>(std::forward<F>(fn))]() mutable {
+    try {
+      ex.post([s = std::move(s), p = std::move(p), fn = std::move(fn)]() mutable {
+        details::fulfill(p, fn, future<T>(std::move(s)), returns_future());
+      });
+    } catch (...) {
+      // The executor refused it (a pool that's shut down); dropping p
+      // breaks the promise, which is what the caller will see
+    }
+  });
+  return result;
+}
+
+template <typename T>
+future<std::decay_t<T>> make_ready_future(T &&value) {
+  promise<std::decay_t<T>> p;
+  p.set_value(std::forward<T>(value));
+  return p.get_future();
+}
+
+inline future<void> make_ready_future() {
+  promise<void> p;
+  p.set_value();
+  return p.get_future();
+}
+
+template <typename T>
+future<T> make_exceptional_future(std::exception_ptr e) {
+  promise<T> p;
+  p.set_exception(std::move(e));
+  return p.get_future();
+}
+
+namespace details {
+template <typename Body>
+class loop {
+public:
+  explicit loop(Body body) : body(std::move(body)) {}
+
+  // Runs iterations back to back for as long as body's futures are ready
+  // already. When one isn't, the thread that finishes it picks the loop up
+  // here again, so the stack stays flat however many iterations there are.
+  static void resume(std::shared_ptr<loop> l) {
+    for (;;) {
+      try {
+        if (l->pending.valid() && !l->pending.get()) {
+          l->done.set_value();
+          return;
+        }
+        l->pending = l->body();
+        if (!l->pending.valid()) throw std::future_error(std::future_errc::no_state);
+      } catch (...) {
+        l->done.set_exception(std::current_exception());
+        return;
+      }
+      if (l->pending.when_ready([l]() { resume(l); })) return;
+    }
+  }
+
+  promise<void> done;
+
+private:
+  Body body;
+  future<bool> pending;
+};
+}
+
+// An asynchronous loop: calls body() (which returns a future<bool>), and once
+// that future is ready, calls it again if it held true. The returned future
+// is ready when body's future holds false, or holds the exception body threw
+// or stored. Iterations cost nothing beyond body's own future: no threads, no
+// allocations, no stack.
+template <typename Body>
+future<void> do_while(Body body) {
+  auto l = std::make_shared<details::loop<Body>>(std::move(body));
+  auto result = l->done.get_future();
+  details::loop<Body>::resume(std::move(l));
+  return result;
+}
+
+namespace details {
+// Shared by the callbacks of one when_all; settles `done` when the last one
+// comes in, with the first exception any of them saw
+class join_state {
+public:
+  explicit join_state(size_t n) : left(n) {}
+
+  void fail(std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(m);
+    if (!error) error = std::move(e);
+  }
+
+  void arrive() {
+    if (left.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    if (error) {
+      done.set_exception(error);
+    } else {
+      done.set_value();
+    }
+  }
+
+  promise<void> done;
+
+private:
+  std::atomic<size_t> left;
+  std::mutex m;
+  std::exception_ptr error;
+};
+
+template <typename T, typename OutputIt>
+void collect(future<T> &r, OutputIt slot) {
+  *slot = r.get();
+}
+
+template <typename OutputIt>
+void collect(future<void> &r, OutputIt) {
+  r.get();
+}
+
+template <typename InputIt, typename OutputIt>
+future<void> join(InputIt first, InputIt last, OutputIt out) {
+  auto n = static_cast<size_t>(std::distance(first, last));
+  if (n == 0) return make_ready_future();
+  auto j = std::make_shared<join_state>(n);
+  auto result = j->done.get_future();
+  for (; first != last; ++first, ++out) {
+    first->on_ready([j, out](typename std::iterator_traits<InputIt>::value_type r) {
+      try {
+        collect(r, out);
+      } catch (...) {
+        j->fail(std::current_exception());
+      }
+      j->arrive();
+    });
+  }
+  return result;
+}
+
+struct no_output {
+  no_output &operator++() {
+    return *this;
+  }
+};
+
+template <typename InputIt>
+future<void> gather(InputIt first, InputIt last, future<void> *) {
+  return join(first, last, no_output());
+}
+
+template <typename InputIt, typename T>
+future<std::vector<T>> gather(InputIt first, InputIt last, future<T> *) {
+  auto results = std::make_shared<std::vector<T>>(static_cast<size_t>(std::distance(first, last)));
+  return join(first, last, results->begin()).then([results](future<void> f) {
+    f.get();
+    return std::move(*results);
+  });
+}
+}
+
+// A future that's ready once every future in [first, last) is, without a
+// thread sitting in get() meanwhile. Results are moved straight into the
+// output range starting at `out` (in order, one per future), which must stay
+// put until then. Fails with the first exception any of them held, after all
+// of them are done. Leaves the input futures empty.
+template <typename InputIt, typename OutputIt>
+future<void> when_all(InputIt first, InputIt last, OutputIt out) {
+  return details::join(first, last, out);
+}
+
+// when_all() into a fresh vector (so T must be default-constructible), or
+// just a future<void> for a range of future<void>
+template <typename InputIt>
+auto when_all(InputIt first, InputIt last) {
+  typedef typename std::iterator_traits<InputIt>::value_type F;
+  return details::gather(first, last, static_cast<F *>(nullptr));
+}
+
+// A future for the index (from `first`) of the first future in [first, last)
+// to become ready. The futures themselves are left alone so the winner can be
+// read with get(); the rest can be passed to when_any() again, or have then()
+// hung on them.
+template <typename InputIt>
+future<size_t> when_any(InputIt first, InputIt last) {
+  if (first == last) throw std::invalid_argument("when_any of no futures");
+  struct race {
+    std::atomic<bool> won{false};
+    promise<size_t> done;
+  };
+  auto r = std::make_shared<race>();
+  auto result = r->done.get_future();
+  size_t i = 0;
+  for (; first != last; ++first, ++i) {
+    auto finish = [r, i]() {
+      if (!r->won.exchange(true, std::memory_order_acq_rel)) r->done.set_value(i);
+    };
+    if (!first->when_ready(finish)) {
+      // Already ready: no need to look at the rest
+      finish();
+      break;
+    }
+  }
+  return result;
+}
+}
+
+#endif
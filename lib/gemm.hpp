@@ -0,0 +1,412 @@
+#ifndef GEMM_HPP
+#define GEMM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include "matrix.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CS477_GEMM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Lets GCC and Clang compile one function for a newer instruction set than
+// the rest of the program; MSVC takes the intrinsics as they are
+#if defined(CS477_GEMM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CS477_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CS477_TARGET(isa)
+#endif
+
+namespace cs477 {
+namespace details {
+namespace gemm {
+
+// The result is computed MR x NR elements at a time, in registers. A is cut
+// into MC x KC blocks (sized for L2) and B into KC x NC panels (for L3); both
+// are copied ("packed") so the kernel reads them in order, from memory it
+// just touched.
+const int MR = 6, NR = 16;
+const int MC = 120, KC = 256, NC = 4096;
+
+enum class isa { scalar, sse, avx2 };
+
+inline isa detect_isa() {
+  bool sse41 = false, avx2 = false;
+#if defined(CS477_GEMM_X86) && defined(_MSC_VER)
+  int r[4];
+  __cpuid(r, 0);
+  auto leaves = r[0];
+  __cpuid(r, 1);
+  sse41 = (r[2] & (1 << 19)) != 0;
+  bool fma = (r[2] & (1 << 12)) != 0;
+  // The OS has to save the ymm registers too
+  bool ymm = (r[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+  if (leaves >= 7) {
+    __cpuidex(r, 7, 0);
+    avx2 = fma && ymm && (r[1] & (1 << 5)) != 0;
+  }
+#elif defined(CS477_GEMM_X86)
+  __builtin_cpu_init();
+  sse41 = __builtin_cpu_supports("sse4.1");
+  avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+
+  // CS477_GEMM=scalar or sse holds the kernels back, to compare them
+  std::string limit;
+#ifdef _MSC_VER
+  char *env = nullptr;
+  size_t len = 0;
+  if (!_dupenv_s(&env, &len, "CS477_GEMM") && env) {
+    limit = env;
+    free(env);
+  }
+#else
+  if (auto env = std::getenv("CS477_GEMM")) limit = env;
+#endif
+  if (limit == "scalar") return isa::scalar;
+  if (avx2 && limit != "sse") return isa::avx2;
+  if (sse41) return isa::sse;
+  return isa::scalar;
+}
+
+inline isa best_isa() {
+  static const isa best = detect_isa();
+  return best;
+}
+
+// Memory from aligned_allocate, freed when this goes
+template <typename S>
+class buffer {
+public:
+  explicit buffer(size_t n) : data(static_cast<S *>(aligned_allocate(n * sizeof(S)))) {}
+
+  ~buffer() {
+    aligned_free(data);
+  }
+
+  buffer(const buffer &) = delete;
+  buffer &operator=(const buffer &) = delete;
+
+  S *const data;
+};
+
+// Rows [i0, i0 + mc) and columns [k0, k0 + kc) of a, as MR-row slivers one
+// after another. Within a sliver the MR values of each column are adjacent;
+// rows past the end of a are zeros.
+template <typename S, typename T>
+void pack_a(matrix_view<const T> a, unsigned i0, int mc, unsigned k0, int kc, S *out) {
+  for (int s = 0; s < mc; s += MR) {
+    const int rows = std::min(MR, mc - s);
+    for (int r = 0; r < MR; ++r) {
+      auto dst = out + r;
+      if (r < rows) {
+        auto src = a.row_data(i0 + s + r) + k0;
+        for (int k = 0; k < kc; ++k, dst += MR) *dst = static_cast<S>(src[k]);
+      } else {
+        for (int k = 0; k < kc; ++k, dst += MR) *dst = S(0);
+      }
+    }
+    out += static_cast<size_t>(kc) * MR;
+  }
+}
+
+// Sliver q (NR columns from j0 + q * NR) of rows [k0, k0 + kc) of b: NR
+// values per row, columns past the end of b are zeros
+template <typename S, typename T>
+void pack_b(matrix_view<const T> b, unsigned k0, int kc, unsigned j0, int nc, int q, S *out) {
+  const int cols = std::min(NR, nc - q * NR);
+  out += static_cast<size_t>(q) * kc * NR;
+  for (int k = 0; k < kc; ++k, out += NR) {
+    auto src = b.row_data(k0 + k) + j0 + q * NR;
+    int j = 0;
+    for (; j < cols; ++j) out[j] = static_cast<S>(src[j]);
+    for (; j < NR; ++j) out[j] = S(0);
+  }
+}
+
+// tile = a sliver times b sliver: the portable kernel (which compilers
+// vectorize somewhat on their own)
+template <typename S>
+void kernel_scalar(int kc, const S *a, const S *b, S *tile) {
+  for (int i = 0; i < MR * NR; ++i) tile[i] = S(0);
+  for (int k = 0; k < kc; ++k, a += MR, b += NR) {
+    for (int r = 0; r < MR; ++r) {
+      const S ar = a[r];
+      for (int j = 0; j < NR; ++j) tile[r * NR + j] += ar * b[j];
+    }
+  }
+}
+
+#if defined(CS477_GEMM_X86)
+// A row of the tile is two ymm registers, so the whole 6 x 16 tile is 12 of
+// the 16; each step broadcasts one value of a and multiplies it into a row
+CS477_TARGET("avx2,fma")
+inline void kernel_avx2(int kc, const float *a, const float *b, float *tile) {
+  __m256 c[MR][2];
+  for (int r = 0; r < MR; ++r) c[r][0] = c[r][1] = _mm256_setzero_ps();
+  for (int k = 0; k < kc; ++k, a += MR, b += NR) {
+    const __m256 b0 = _mm256_load_ps(b), b1 = _mm256_load_ps(b + 8);
+    for (int r = 0; r < MR; ++r) {
+      const __m256 ar = _mm256_broadcast_ss(a + r);
+      c[r][0] = _mm256_fmadd_ps(ar, b0, c[r][0]);
+      c[r][1] = _mm256_fmadd_ps(ar, b1, c[r][1]);
+    }
+  }
+  for (int r = 0; r < MR; ++r) {
+    _mm256_store_ps(tile + r * NR, c[r][0]);
+    _mm256_store_ps(tile + r * NR + 8, c[r][1]);
+  }
+}
+
+CS477_TARGET("avx2")
+inline void kernel_avx2(int kc, const int *a, const int *b, int *tile) {
+  __m256i c[MR][2];
+  for (int r = 0; r < MR; ++r) c[r][0] = c[r][1] = _mm256_setzero_si256();
+  for (int k = 0; k < kc; ++k, a += MR, b += NR) {
+    const __m256i b0 = _mm256_load_si256(reinterpret_cast<const __m256i *>(b)), b1 = _mm256_load_si256(reinterpret_cast<const __m256i *>(b + 8));
+    for (int r = 0; r < MR; ++r) {
+      const __m256i ar = _mm256_set1_epi32(a[r]);
+      c[r][0] = _mm256_add_epi32(c[r][0], _mm256_mullo_epi32(ar, b0));
+      c[r][1] = _mm256_add_epi32(c[r][1], _mm256_mullo_epi32(ar, b1));
+    }
+  }
+  for (int r = 0; r < MR; ++r) {
+    _mm256_store_si256(reinterpret_cast<__m256i *>(tile + r * NR), c[r][0]);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(tile + r * NR + 8), c[r][1]);
+  }
+}
+
+// With 16-byte registers a 6 x 16 tile won't fit, so it's done as two
+// 6 x 8 halves, each a full pass over k
+CS477_TARGET("sse2")
+inline void kernel_sse(int kc, const float *a, const float *b, float *tile) {
+  for (int half = 0; half < NR; half += 8) {
+    __m128 c[MR][2];
+    for (int r = 0; r < MR; ++r) c[r][0] = c[r][1] = _mm_setzero_ps();
+    auto ap = a;
+    auto bp = b + half;
+    for (int k = 0; k < kc; ++k, ap += MR, bp += NR) {
+      const __m128 b0 = _mm_load_ps(bp), b1 = _mm_load_ps(bp + 4);
+      for (int r = 0; r < MR; ++r) {
+        const __m128 ar = _mm_set1_ps(ap[r]);
+        c[r][0] = _mm_add_ps(c[r][0], _mm_mul_ps(ar, b0));
+        c[r][1] = _mm_add_ps(c[r][1], _mm_mul_ps(ar, b1));
+      }
+    }
+    for (int r = 0; r < MR; ++r) {
+      _mm_store_ps(tile + r * NR + half, c[r][0]);
+      _mm_store_ps(tile + r * NR + half + 4, c[r][1]);
+    }
+  }
+}
+
+CS477_TARGET("sse4.1")
+inline void kernel_sse(int kc, const int *a, const int *b, int *tile) {
+  for (int half = 0; half < NR; half += 8) {
+    __m128i c[MR][2];
+    for (int r = 0; r < MR; ++r) c[r][0] = c[r][1] = _mm_setzero_si128();
+    auto ap = a;
+    auto bp = b + half;
+    for (int k = 0; k < kc; ++k, ap += MR, bp += NR) {
+      const __m128i b0 = _mm_load_si128(reinterpret_cast<const __m128i *>(bp)), b1 = _mm_load_si128(reinterpret_cast<const __m128i *>(bp + 4));
+      for (int r = 0; r < MR; ++r) {
+        const __m128i ar = _mm_set1_epi32(ap[r]);
+        c[r][0] = _mm_add_epi32(c[r][0], _mm_mullo_epi32(ar, b0));
+        c[r][1] = _mm_add_epi32(c[r][1], _mm_mullo_epi32(ar, b1));
+      }
+    }
+    for (int r = 0; r < MR; ++r) {
+      _mm_store_si128(reinterpret_cast<__m128i *>(tile + r * NR + half), c[r][0]);
+      _mm_store_si128(reinterpret_cast<__m128i *>(tile + r * NR + half + 4), c[r][1]);
+    }
+  }
+}
+#endif
+
+// Picks the kernel for an element type once per multiply
+template <typename S>
+struct kernel {
+  typedef void (*fn)(int, const S *, const S *, S *);
+
+  static fn pick() {
+    return kernel_scalar<S>;
+  }
+};
+
+#if defined(CS477_GEMM_X86)
+template <typename S>
+struct simd_kernel {
+  typedef void (*fn)(int, const S *, const S *, S *);
+
+  static fn pick() {
+    switch (best_isa()) {
+    case isa::avx2:
+      return kernel_avx2;
+    case isa::sse:
+      return kernel_sse;
+    default:
+      return kernel_scalar<S>;
+    }
+  }
+};
+
+template <>
+struct kernel<float> : simd_kernel<float> {};
+
+template <>
+struct kernel<int> : simd_kernel<int> {};
+#endif
+
+// Adds the valid mr x nr corner of a tile into c
+template <typename S>
+void add_tile(const S *tile, S *c, size_t ldc, int mr, int nr) {
+  for (int r = 0; r < mr; ++r, c += ldc) {
+    for (int j = 0; j < nr; ++j) c[j] += tile[r * NR + j];
+  }
+}
+
+// c += a * b, with a and b converted to S as they're packed. Blocks of c
+// are handed out to executor's threads; c must already be the right size.
+// Any of them may be part of a bigger matrix.
+template <typename S, typename T, typename Executor>
+void multiply_into(Executor &executor, matrix_view<const T> a, matrix_view<const T> b, matrix_view<S> c) {
+  const unsigned m = a.rows, n = b.cols, depth = a.cols;
+  if (!m || !n || !depth) return;
+  const int threads = std::max(1, static_cast<int>(executor.size()));
+  const auto run = kernel<S>::pick();
+  buffer<S> packed_b(static_cast<size_t>(KC) * NC);
+
+  // Calls fn(0) ... fn(count - 1) on up to `threads` threads, each taking
+  // the next index as it frees up
+  auto each = [&](int count, const std::function<void(int, S *)> &fn, bool scratch) {
+    std::atomic<int> next(0);
+    executor.parallel_for_range(0, std::min(threads, count), [&](int w0, int w1) {
+      for (int w = w0; w < w1; ++w) {
+        std::unique_ptr<buffer<S>> packed_a(scratch ? new buffer<S>(static_cast<size_t>(MC) * KC) : nullptr);
+        for (int i; (i = next.fetch_add(1)) < count;) fn(i, packed_a ? packed_a->data : nullptr);
+      }
+    });
+  };
+
+  for (unsigned j0 = 0; j0 < n; j0 += NC) {
+    const int nc = static_cast<int>(std::min<unsigned>(NC, n - j0));
+    const int slivers_b = (nc + NR - 1) / NR;
+    for (unsigned k0 = 0; k0 < depth; k0 += KC) {
+      const int kc = static_cast<int>(std::min<unsigned>(KC, depth - k0));
+      each(slivers_b, [&](int q, S *) { pack_b(b, k0, kc, j0, nc, q, packed_b.data); }, false);
+
+      // Split the columns too when there are few row blocks (a skinny a),
+      // so every thread still gets a few tasks
+      const int blocks_a = static_cast<int>((m + MC - 1) / MC);
+      const int groups = std::min(slivers_b, std::max(1, (4 * threads + blocks_a - 1) / blocks_a));
+      const int per_group = (slivers_b + groups - 1) / groups;
+      each(blocks_a * groups, [&](int task, S *packed_a) {
+        const unsigned i0 = static_cast<unsigned>(task / groups) * MC;
+        const int mc = static_cast<int>(std::min<unsigned>(MC, m - i0));
+        const int q0 = (task % groups) * per_group, q1 = std::min(slivers_b, q0 + per_group);
+        if (q0 >= q1) return;
+        pack_a(a, i0, mc, k0, kc, packed_a);
+        alignas(64) S tile[MR * NR];
+        // One sliver of b stays in L1 while every sliver of a goes past it
+        for (int q = q0; q < q1; ++q) {
+          const unsigned col = j0 + q * NR;
+          const int nr = static_cast<int>(std::min<unsigned>(NR, n - col));
+          for (int s = 0; s < mc; s += MR) {
+            run(kc, packed_a + static_cast<size_t>(s) * kc, packed_b.data + static_cast<size_t>(q) * kc * NR, tile);
+            add_tile(tile, c.row_data(i0 + s) + col, c.stride, std::min(MR, mc - s), nr);
+          }
+        }
+      }, true);
+    }
+  }
+}
+
+// Runs everything on the calling thread
+struct inline_executor {
+  int size() const {
+    return 1;
+  }
+
+  template <typename Iter, typename Fn>
+  void parallel_for_range(Iter start, Iter end, Fn fn) {
+    fn(start, end);
+  }
+};
+
+template <typename T, typename Executor>
+basic_matrix<T> multiply(Executor &executor, matrix_view<const T> x, matrix_view<const T> y, std::true_type /* sums fit in T */) {
+  basic_matrix<T> z;
+  z.create(x.rows, y.cols);
+  multiply_into(executor, x, y, z.view());
+  return z;
+}
+
+// Byte and short products are summed as ints and clamped at the end
+template <typename T, typename Executor>
+basic_matrix<T> multiply(Executor &executor, matrix_view<const T> x, matrix_view<const T> y, std::false_type) {
+  basic_matrix<decltype(T() * T())> z;
+  z.create(x.rows, y.cols);
+  multiply_into(executor, x, y, z.view());
+  return matrix_cast<T>(z);
+}
+}
+}
+
+// x * y as a cache-blocked, packed multiply, split into blocks of the
+// result that run on `executor` (a Pool, or anything else with size() and
+// parallel_for_range). int and float use AVX2 or SSE kernels when the CPU
+// has them; other element types get the same blocking with plain loops.
+// x and y may be views (a tile of a bigger matrix, say); they are read in
+// place.
+template <typename T, typename U, typename Executor>
+basic_matrix<typename std::remove_const<T>::type> multiply(Executor &executor, matrix_view<T> x, matrix_view<U> y) {
+  typedef typename std::remove_const<T>::type V;
+  static_assert(std::is_same<V, typename std::remove_const<U>::type>::value, "matrix elements must be the same type (see matrix_cast)");
+  if (x.cols != y.rows) {
+    throw std::invalid_argument("Invalid arguments");
+  }
+  return details::gemm::multiply(executor, matrix_view<const V>(x), matrix_view<const V>(y), std::is_same<V, decltype(V() * V())>());
+}
+
+template <typename T, typename Executor>
+basic_matrix<T> multiply(Executor &executor, const basic_matrix<T> &x, const basic_matrix<T> &y) {
+  return multiply(executor, x.view(), y.view());
+}
+
+// The same on the calling thread alone
+template <typename T, typename U>
+basic_matrix<typename std::remove_const<T>::type> multiply(matrix_view<T> x, matrix_view<U> y) {
+  details::gemm::inline_executor one;
+  return multiply(one, x, y);
+}
+
+template <typename T>
+basic_matrix<T> multiply(const basic_matrix<T> &x, const basic_matrix<T> &y) {
+  return multiply(x.view(), y.view());
+}
+
+// Which kernel multiply() uses on this machine
+inline const char *multiply_kernel() {
+  switch (details::gemm::best_isa()) {
+  case details::gemm::isa::avx2:
+    return "avx2";
+  case details::gemm::isa::sse:
+    return "sse";
+  default:
+    return "scalar";
+  }
+}
+}
+
+#endif
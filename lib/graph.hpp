@@ -0,0 +1,222 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "future.hpp"
+#include "pool.hpp"
+
+namespace cs477 {
+
+// A reusable task graph. Nodes are functions of the run's `Input` (which
+// carries the data flowing along the edges); an edge a -> b means b reads
+// something a wrote. Build it once, then run it once per input: every node
+// whose inputs are done goes straight to a pool worker, so independent
+// branches run side by side.
+//
+// Runs may overlap. Each one borrows a recycled run record, so a run only
+// allocates the shared state behind the future it returns.
+template <typename Input>
+class graph {
+public:
+  typedef int node;
+
+  explicit graph(Pool &pool = default_pool()) : pool(pool), sealed(false) {}
+
+  graph(const graph &) = delete;
+  graph &operator=(const graph &) = delete;
+
+  // Adds fn(Input&) as a node
+  template <typename F>
+  node add(F fn) {
+    std::lock_guard<std::mutex> lock(m);
+    check_open();
+    nodes.emplace_back();
+    nodes.back().fn = std::move(fn);
+    return static_cast<node>(nodes.size() - 1);
+  }
+
+  // Adds a node that runs once every node in `after` is done
+  template <typename F>
+  node add(F fn, std::initializer_list<node> after) {
+    auto n = add(std::move(fn));
+    for (auto a : after) precede(a, n);
+    return n;
+  }
+
+  // `before` must finish before `after` starts
+  void precede(node before, node after) {
+    std::lock_guard<std::mutex> lock(m);
+    check_open();
+    if (!valid(before) || !valid(after) || before == after) throw std::invalid_argument("bad graph edge");
+    nodes[before].next.push_back(after);
+    nodes[after].inputs++;
+  }
+
+  int size() const {
+    return static_cast<int>(nodes.size());
+  }
+
+  // Runs every node against `in`, which must outlive the run. The future
+  // carries the first exception thrown by a node; nodes that hadn't started
+  // by then are skipped.
+  cs477::future<void> run(Input &in) {
+    seal();
+    auto r = acquire();
+    r->in = &in;
+    r->failed.store(false, std::memory_order_relaxed);
+    r->error = nullptr;
+    r->left.store(static_cast<int>(nodes.size()), std::memory_order_relaxed);
+    for (size_t i = 0; i < nodes.size(); ++i) r->waiting[i].store(nodes[i].inputs, std::memory_order_relaxed);
+    cs477::promise<void> p;
+    auto f = p.get_future();
+    r->done = std::move(p);
+    if (nodes.empty()) {
+      finish(r);
+      return f;
+    }
+    //One job fans the roots out, so a pool that refuses work refuses all of it
+    try {
+      pool.post([this, r]() {
+        for (size_t i = 1; i < roots.size(); ++i) {
+          auto root = roots[i];
+          pool.post([this, r, root]() { execute(r, root); });
+        }
+        execute(r, roots[0]);
+      });
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(m);
+      spare.push_back(r);
+      throw;
+    }
+    return f;
+  }
+
+  // run(), then help the pool out until it's done
+  void run_and_wait(Input &in) {
+    auto f = run(in);
+    pool.get(f);
+  }
+
+private:
+  struct vertex {
+    std::function<void(Input &)> fn;
+    std::vector<node> next;
+    int inputs = 0;
+  };
+
+  // Per-run bookkeeping, recycled between runs
+  struct record {
+    Input *in;
+    std::unique_ptr<std::atomic<int>[]> waiting;
+    std::atomic<int> left;
+    std::atomic<bool> failed;
+    std::mutex m;
+    std::exception_ptr error;
+    cs477::promise<void> done;
+  };
+
+  bool valid(node n) const {
+    return n >= 0 && n < static_cast<node>(nodes.size());
+  }
+
+  // m must be held, so the graph can't be sealed (and read by a run) halfway
+  // through a change
+  void check_open() {
+    if (sealed) throw std::logic_error("graph can't change once it has run");
+  }
+
+  // Freezes the graph on the first run: finds the roots and rejects cycles
+  void seal() {
+    std::lock_guard<std::mutex> lock(m);
+    if (sealed) return;
+    std::vector<int> inputs;
+    std::vector<node> order;
+    for (auto &v : nodes) inputs.push_back(v.inputs);
+    for (node i = 0; i < size(); ++i) {
+      if (inputs[i] == 0) order.push_back(i);
+    }
+    roots = order;
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (auto n : nodes[order[i]].next) {
+        if (--inputs[n] == 0) order.push_back(n);
+      }
+    }
+    if (order.size() != nodes.size()) throw std::logic_error("graph has a cycle");
+    sealed = true;
+  }
+
+  record *acquire() {
+    std::lock_guard<std::mutex> lock(m);
+    if (spare.empty()) {
+      std::unique_ptr<record> r(new record);
+      r->waiting.reset(new std::atomic<int>[nodes.size()]);
+      all.push_back(std::move(r));
+      return all.back().get();
+    }
+    auto r = spare.back();
+    spare.pop_back();
+    return r;
+  }
+
+  // Runs node n, then whichever successors it made ready: the first one on
+  // this thread (its input is still hot in cache), the rest on the pool
+  void execute(record *r, node n) {
+    while (n >= 0) {
+      if (!r->failed.load(std::memory_order_relaxed)) {
+        try {
+          nodes[n].fn(*r->in);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(r->m);
+          if (!r->error) r->error = std::current_exception();
+          r->failed.store(true, std::memory_order_relaxed);
+        }
+      }
+      node following = -1;
+      for (auto s : nodes[n].next) {
+        if (r->waiting[s].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+        if (following < 0) {
+          following = s;
+        } else {
+          pool.post([this, r, s]() { execute(r, s); });
+        }
+      }
+      if (r->left.fetch_sub(1, std::memory_order_acq_rel) == 1) finish(r);
+      n = following;
+    }
+  }
+
+  void finish(record *r) {
+    auto done = std::move(r->done);
+    auto error = std::move(r->error);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      spare.push_back(r);
+    }
+    if (error) {
+      done.set_exception(error);
+    } else {
+      done.set_value();
+    }
+  }
+
+  Pool &pool;
+  std::vector<vertex> nodes;
+  std::vector<node> roots;
+  // Guarded by m, like nodes until it is set
+  bool sealed;
+  std::mutex m;
+  std::vector<std::unique_ptr<record>> all;
+  std::vector<record *> spare;
+};
+}
+
+#endif
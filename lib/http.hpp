@@ -4,8 +4,10 @@
 #include <string>
 #include <vector>
 #include <future>
+#include <memory>
+#include "future.hpp"
 #include "network.hpp"
-#include "promise-polyfill.hpp"
+#include "trace.hpp"
 #include "../vendor/http_parser.h"
 
 namespace cs477 {
@@ -22,7 +24,7 @@ public:
 
 http_request read_http_request(const char *buf, uint32_t len);
 http_request read_http_request(socket &sock);
-std::future<http_request> read_http_request_async(socket sock);
+cs477::future<http_request> read_http_request_async(socket sock);
 
 class http_response {
 public:
@@ -34,7 +36,7 @@ public:
 
 std::string write_http_response(const http_response &rsp);
 void write_http_response(socket &sock, const http_response &rsp);
-std::future<void> write_http_response_async(socket sock, const http_response &rsp);
+cs477::future<void> write_http_response_async(socket sock, const http_response &rsp);
 
 const std::error_category &http_category();
 }
@@ -118,6 +120,7 @@ inline http_request read_http_request(const char *str, uint32_t len) {
   http_parser_init(&state, HTTP_REQUEST);
   state.data = &state;
 
+  TRACE_SPAN("http parse", "bytes", len);
   auto parsed = http_parser_execute(&state, &state, str, len);
   if (state.http_errno) {
     throw std::system_error(state.http_errno, http_category());
@@ -147,6 +150,7 @@ inline http_request read_http_request(socket &sock) {
 
   for (;;) {
     auto len = sock.recv(&str.front(), 65536);
+    TRACE_SPAN("http parse", "bytes", len);
     auto parsed = http_parser_execute(&state, &state, str.c_str(), len);
     if (parsed != len) {
       throw std::system_error(state.http_errno, http_category());
@@ -160,8 +164,14 @@ inline http_request read_http_request(socket &sock) {
   return std::move(state.rq);
 }
 
-inline std::future<http_request> read_http_request_async(socket sock) {
-  auto state = std::make_shared<http_request_parse_state>();
+// A request being read asynchronously
+struct http_request_reader : public http_request_parse_state {
+  socket sock;
+};
+
+inline cs477::future<http_request> read_http_request_async(socket sock) {
+  auto state = std::make_shared<http_request_reader>();
+  state->sock = std::move(sock);
 
   state->on_message_begin = on_request_begin_message;
   state->on_url = on_request_url;
@@ -172,20 +182,22 @@ inline std::future<http_request> read_http_request_async(socket sock) {
   state->on_message_complete = on_request_message_complete;
 
   http_parser_init(state.get(), HTTP_REQUEST);
-  state->data = state.get();
-
-  auto v = Promise::do_while([state, sock]() mutable {
-    auto f = sock.recv_async().share();
-    return Promise::then(f, [state](std::shared_future<std::string> f2) {
-      auto str = f2.get();
+  state->data = static_cast<http_request_parse_state *>(state.get());
+
+  // One recv per iteration, parsed on the I/O thread that completed it,
+  // until the parser has a whole request
+  return cs477::do_while([state]() {
+    return state->sock.recv_async().then([state](cs477::future<std::string> f) {
+      auto str = f.get();
+      TRACE_SPAN("http parse", "bytes", static_cast<int64_t>(str.length()));
       auto parsed = http_parser_execute(state.get(), state.get(), str.c_str(), str.length());
       if (parsed != str.length()) {
         throw std::system_error(state->http_errno, http_category());
       }
       return state->state != http_request_parse_state::done;
     });
-  });
-  return Promise::then(v.share(), [state, sock](std::shared_future<void> f) {
+  }).then([state](cs477::future<void> f) {
+    f.get();
     return std::move(state->rq);
   });
 }
@@ -219,7 +231,7 @@ inline void write_http_response(socket &sock, const http_response &rsp) {
   sock.send(text.c_str(), static_cast<uint32_t>(text.length()));
 }
 
-inline std::future<void> write_http_response_async(socket sock, const http_response &rsp) {
+inline cs477::future<void> write_http_response_async(socket sock, const http_response &rsp) {
   auto text = write_http_response(rsp);
   return sock.send_async(text.c_str(), static_cast<uint32_t>(text.length()));
 }
@@ -5,16 +5,71 @@
 
 #include "matrix.hpp"
 #include "file.hpp"
-#include "promise-polyfill.hpp"
+#include "future.hpp"
+#include "trace.hpp"
 
+#include <memory>
 #include <wincodec.h>
 #pragma comment(lib, "windowscodecs.lib")
 
-// Loads an image and turns it into a matrix.
-inline matrix load_image(const std::tr2::sys::path &path) {
+namespace cs477 {
+namespace details {
+// Reads the converter's 8-bit gray pixels into x, widening them if x holds
+// something bigger than bytes
+template <typename T>
+HRESULT copy_pixels(IWICFormatConverter *convert, basic_matrix<T> &x) {
+  unsigned w, h;
+  convert->GetSize(&w, &h);
+  std::unique_ptr<BYTE[]> buf(new BYTE[w * h]);
+  auto hr = convert->CopyPixels(nullptr, w, w * h, buf.get());
+  if (SUCCEEDED(hr)) {
+    x.create(h, w);
+
+    auto ptr = buf.get();
+    auto end = ptr + w * h;
+    auto xptr = x.data;
+    while (ptr != end) {
+      *xptr++ = *ptr++;
+    }
+  }
+  return hr;
+}
+
+// A byte image takes the pixels straight into its own storage
+inline HRESULT copy_pixels(IWICFormatConverter *convert, byte_matrix &x) {
+  unsigned w, h;
+  convert->GetSize(&w, &h);
+  x.create(h, w);
+  auto hr = convert->CopyPixels(nullptr, w, w * h, x.data);
+  if (FAILED(hr)) x = byte_matrix();
+  return hr;
+}
+
+// x as 8-bit gray pixels, clamped to 0..255; `converted` keeps them alive
+template <typename T>
+const BYTE *gray_pixels(const basic_matrix<T> &x, std::unique_ptr<BYTE[]> &converted) {
+  auto size = x.rows * x.cols;
+  converted.reset(new BYTE[size]);
+  for (unsigned i = 0; i < size; i++) {
+    converted[i] = saturate_cast<uint8_t>(x.data[i]);
+  }
+  return converted.get();
+}
+
+inline const BYTE *gray_pixels(const byte_matrix &x, std::unique_ptr<BYTE[]> &) {
+  return x.data;
+}
+}
+}
+
+// Loads an image as 8-bit gray and turns it into a matrix. Ask for a
+// byte_matrix (load_image<uint8_t>) to keep one byte per pixel.
+template <typename T = int>
+basic_matrix<T> load_image(const std::tr2::sys::path &path) {
+  TRACE_SPAN("load_image");
   auto hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
 
-  matrix x;
+  basic_matrix<T> x;
 
   IWICImagingFactory *wic = nullptr;
   IWICStream *stream = nullptr;
@@ -50,23 +105,7 @@ inline matrix load_image(const std::tr2::sys::path &path) {
       return hr;
     }
 
-    unsigned w, h;
-    convert->GetSize(&w, &h);
-    BYTE *buf = new BYTE[w * h];
-    hr = convert->CopyPixels(nullptr, w, w * h, buf);
-    if (SUCCEEDED(hr)) {
-      x.create(h, w);
-
-      auto ptr = buf;
-      auto end = ptr + w * h;
-      auto xptr = x.data;
-      while (ptr != end) {
-        *xptr++ = *ptr++;
-      }
-    }
-
-    delete[] buf;
-    return hr;
+    return cs477::details::copy_pixels(convert, x);
   }();
 
   if (convert) convert->Release();
@@ -79,10 +118,12 @@ inline matrix load_image(const std::tr2::sys::path &path) {
   return x;
 }
 
-inline matrix load_image(const void *buf, size_t len) {
+template <typename T = int>
+basic_matrix<T> load_image(const void *buf, size_t len) {
+  TRACE_SPAN("decode_image");
   auto hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
 
-  matrix x;
+  basic_matrix<T> x;
 
   IWICImagingFactory *wic = nullptr;
   IWICStream *stream = nullptr;
@@ -118,23 +159,7 @@ inline matrix load_image(const void *buf, size_t len) {
       return hr;
     }
 
-    unsigned w, h;
-    convert->GetSize(&w, &h);
-    BYTE *buf = new BYTE[w * h];
-    hr = convert->CopyPixels(nullptr, w, w * h, buf);
-    if (SUCCEEDED(hr)) {
-      x.create(h, w);
-
-      auto ptr = buf;
-      auto end = ptr + w * h;
-      auto xptr = x.data;
-      while (ptr != end) {
-        *xptr++ = *ptr++;
-      }
-    }
-
-    delete[] buf;
-    return hr;
+    return cs477::details::copy_pixels(convert, x);
   }();
 
   if (convert) convert->Release();
@@ -147,15 +172,20 @@ inline matrix load_image(const void *buf, size_t len) {
   return x;
 }
 
-std::future<matrix> load_image_async(const std::tr2::sys::path &path) {
-  return Promise::then(read_file_async(path.string().c_str()).share(), [](auto f) {
+// Decodes on the I/O thread that finished the read
+template <typename T = int>
+cs477::future<basic_matrix<T>> load_image_async(const std::tr2::sys::path &path) {
+  return read_file_async(path.string().c_str()).then([](cs477::future<std::string> f) {
     auto data = f.get();
-    return load_image(data.c_str(), data.size());
+    return load_image<T>(data.c_str(), data.size());
   });
 }
 
-// Writes the matrix as an 8-bit-per-pixel PNG
-inline void save_png(const matrix &x, const std::tr2::sys::path &path) {
+// Writes the matrix as an 8-bit-per-pixel PNG (values outside 0..255 are
+// clamped)
+template <typename T>
+void save_png(const basic_matrix<T> &x, const std::tr2::sys::path &path) {
+  TRACE_SPAN("save_png");
   auto hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
 
   IWICImagingFactory *wic = nullptr;
@@ -201,21 +231,9 @@ inline void save_png(const matrix &x, const std::tr2::sys::path &path) {
     GUID format = GUID_WICPixelFormat8bppGray;
     frame->SetPixelFormat(&format);
 
-    BYTE *buf = new BYTE[x.rows * x.cols];
-    auto xptr = x.data;
-    auto xend = xptr + x.rows * x.cols;
-    auto ptr = buf;
-    while (xptr != xend) {
-      auto i = *xptr++;
-      if (i < 0)
-        i = 0;
-      else if (i > 255)
-        i = 255;
-      *ptr++ = i;
-    }
-
-    hr = frame->WritePixels(x.rows, x.cols, x.rows * x.cols, buf);
-    delete[] buf;
+    std::unique_ptr<BYTE[]> converted;
+    auto pixels = cs477::details::gray_pixels(x, converted);
+    hr = frame->WritePixels(x.rows, x.cols, x.rows * x.cols, const_cast<BYTE *>(pixels));
     if (FAILED(hr)) {
       return hr;
     }
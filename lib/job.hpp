@@ -0,0 +1,126 @@
+#ifndef JOB_HPP
+#define JOB_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cs477 {
+
+// A move-only `void()` callable. Callables that fit in `inline_size` bytes
+// (and can be moved without throwing) are stored in place, so queueing one
+// does not touch the heap; anything bigger is boxed.
+class job {
+public:
+  static const size_t inline_size = 48;
+
+  job() : ops(nullptr) {}
+
+  template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, job>::value>>
+  job(F &&f) : ops(nullptr) {
+    emplace(std::forward<F>(f));
+  }
+
+  job(job &&x) noexcept : ops(x.ops) {
+    if (ops) {
+      ops->move(&x.storage, &storage);
+      x.ops = nullptr;
+    }
+  }
+
+  job &operator=(job &&x) noexcept {
+    if (this != &x) {
+      reset();
+      ops = x.ops;
+      if (ops) {
+        ops->move(&x.storage, &storage);
+        x.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  job(const job &) = delete;
+  job &operator=(const job &) = delete;
+
+  ~job() {
+    reset();
+  }
+
+  explicit operator bool() const {
+    return ops != nullptr;
+  }
+
+  void operator()() {
+    ops->invoke(&storage);
+  }
+
+  void reset() {
+    if (ops) {
+      ops->destroy(&storage);
+      ops = nullptr;
+    }
+  }
+
+private:
+  struct vtable {
+    void (*invoke)(void *);
+    // Move-constructs into `to` and destroys `from`
+    void (*move)(void *from, void *to);
+    void (*destroy)(void *);
+  };
+
+  template <typename F>
+  struct inline_ops {
+    static void invoke(void *p) { (*static_cast<F *>(p))(); }
+    static void move(void *from, void *to) {
+      new (to) F(std::move(*static_cast<F *>(from)));
+      static_cast<F *>(from)->~F();
+    }
+    static void destroy(void *p) { static_cast<F *>(p)->~F(); }
+    static const vtable table;
+  };
+
+  template <typename F>
+  struct boxed_ops {
+    static void invoke(void *p) { (**static_cast<F **>(p))(); }
+    static void move(void *from, void *to) { *static_cast<F **>(to) = *static_cast<F **>(from); }
+    static void destroy(void *p) { delete *static_cast<F **>(p); }
+    static const vtable table;
+  };
+
+  template <typename F>
+  using fits_inline = std::integral_constant<bool, sizeof(F) <= inline_size && alignof(std::max_align_t) % alignof(F) == 0 && std::is_nothrow_move_constructible<F>::value>;
+
+  template <typename F>
+  void emplace(F &&f) {
+    emplace(std::forward<F>(f), fits_inline<std::decay_t<F>>());
+  }
+
+  template <typename F>
+  void emplace(F &&f, std::true_type) {
+    using T = std::decay_t<F>;
+    new (&storage) T(std::forward<F>(f));
+    ops = &inline_ops<T>::table;
+  }
+
+  template <typename F>
+  void emplace(F &&f, std::false_type) {
+    using T = std::decay_t<F>;
+    *reinterpret_cast<T **>(&storage) = new T(std::forward<F>(f));
+    ops = &boxed_ops<T>::table;
+  }
+
+  const vtable *ops;
+  std::aligned_storage_t<inline_size, alignof(std::max_align_t)> storage;
+};
+
+template <typename F>
+const job::vtable job::inline_ops<F>::table = {&job::inline_ops<F>::invoke, &job::inline_ops<F>::move, &job::inline_ops<F>::destroy};
+
+template <typename F>
+const job::vtable job::boxed_ops<F>::table = {&job::boxed_ops<F>::invoke, &job::boxed_ops<F>::move, &job::boxed_ops<F>::destroy};
+}
+
+#endif
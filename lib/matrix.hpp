@@ -1,63 +1,345 @@
 #ifndef MATRIX_HPP
 #define MATRIX_HPP
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace cs477 {
+namespace details {
+// Matrix rows start on a cache line (and a full AVX-512 register)
+const size_t matrix_alignment = 64;
+
+inline void *aligned_allocate(size_t bytes) {
+#ifdef _MSC_VER
+  auto p = _aligned_malloc(bytes ? bytes : 1, matrix_alignment);
+#else
+  void *p = nullptr;
+  if (posix_memalign(&p, matrix_alignment, bytes ? bytes : 1)) p = nullptr;
+#endif
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+inline void aligned_free(void *p) {
+#ifdef _MSC_VER
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+template <typename To, typename From>
+To saturate(From v, std::true_type /* to floating point */) {
+  return static_cast<To>(v);
+}
+
+template <typename To, typename From>
+To saturate_integer(From v, std::true_type /* from floating point */) {
+  typedef std::numeric_limits<To> limits;
+  if (v != v) return 0;
+  if (v <= static_cast<From>(limits::min())) return limits::min();
+  if (v >= static_cast<From>(limits::max())) return limits::max();
+  return static_cast<To>(std::round(v));
+}
+
+template <typename To, typename From>
+To saturate_integer(From v, std::false_type /* from an integer */) {
+  typedef std::numeric_limits<To> limits;
+  if (std::is_signed<From>::value && static_cast<intmax_t>(v) < 0) {
+    return std::is_signed<To>::value && static_cast<intmax_t>(v) > static_cast<intmax_t>(limits::min()) ? static_cast<To>(v) : limits::min();
+  }
+  return static_cast<uintmax_t>(v) < static_cast<uintmax_t>(limits::max()) ? static_cast<To>(v) : limits::max();
+}
+
+template <typename To, typename From>
+To saturate(From v, std::false_type /* to an integer */) {
+  return saturate_integer<To>(v, std::is_floating_point<From>());
+}
+}
+
+// Converts v to To, clamping it to To's range instead of wrapping around
+// (300 becomes 255 as a uint8_t, -1 becomes 0). Floating point values are
+// rounded to the nearest integer; NaN becomes 0.
+template <typename To, typename From>
+To saturate_cast(From v) {
+  return details::saturate<To>(v, std::is_floating_point<To>());
+}
+}
+
+// Part of a matrix, without a copy: rows x cols elements starting at data,
+// with row r starting stride elements after row r - 1. It refers to memory
+// someone else owns (usually a basic_matrix; see basic_matrix::view), so it
+// is only good as long as that is. T is const for a read-only view.
+//
+//   auto top = image.submatrix(0, 0, 16, image.cols);
+//   auto t = image.tile(i, j, 64, 64);  // the (i, j)th 64 x 64 tile
+//
+// Copying a view copies the reference, not the elements; assign() writes
+// elements into the view.
+template <typename T>
+struct matrix_view {
+  typedef typename std::remove_const<T>::type value_type;
+  static_assert(std::is_arithmetic<value_type>::value, "matrix elements must be numbers");
+
+  matrix_view() : data(nullptr), rows(0), cols(0), stride(0) {}
+
+  matrix_view(T *data, unsigned rows, unsigned cols, size_t stride) : data(data), rows(rows), cols(cols), stride(stride) {}
+
+  // A view that can write is also one that can read
+  template <typename U, typename = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+  matrix_view(const matrix_view<U> &x) : data(x.data), rows(x.rows), cols(x.cols), stride(x.stride) {}
+
+  T &operator()(unsigned r, unsigned c) const {
+    return data[r * stride + c];
+  }
+
+  // The first element of row r
+  T *row_data(unsigned r) const {
+    return data + r * stride;
+  }
+
+  // Rows are next to each other in memory, so the view is one run of
+  // rows * cols elements
+  bool contiguous() const {
+    return stride == cols || rows <= 1;
+  }
+
+  // rows x cols elements from (r, c)
+  matrix_view submatrix(unsigned r, unsigned c, unsigned rows, unsigned cols) const {
+    if (r > this->rows || c > this->cols || rows > this->rows - r || cols > this->cols - c) {
+      throw std::invalid_argument("Invalid arguments");
+    }
+    return matrix_view(data + r * stride + c, rows, cols, stride);
+  }
+
+  // Tile (i, j) when the view is cut into h x w tiles. Tiles on the bottom and
+  // right edges are smaller when h and w don't divide the view evenly.
+  matrix_view tile(unsigned i, unsigned j, unsigned h, unsigned w) const {
+    if (!h || !w || i >= (rows + h - 1) / h || j >= (cols + w - 1) / w) {
+      throw std::invalid_argument("Invalid arguments");
+    }
+    return submatrix(i * h, j * w, std::min(h, rows - i * h), std::min(w, cols - j * w));
+  }
+
+  matrix_view row(unsigned r) const {
+    return submatrix(r, 0, 1, cols);
+  }
+
+  matrix_view col(unsigned c) const {
+    return submatrix(0, c, rows, 1);
+  }
+
+  // Copies x (the same size) into the view
+  void assign(matrix_view<const value_type> x) const {
+    check(x.rows, x.cols);
+    for (unsigned r = 0; r < rows; r++) {
+      memmove(row_data(r), x.row_data(r), cols * sizeof(T));
+    }
+  }
+
+  // Works out an elementwise expression (see expression.hpp) into the view
+  template <typename E, typename = typename E::expression_tag>
+  void assign(const E &e) const {
+    check(e.rows(), e.cols());
+    for (unsigned r = 0; r < rows; r++) {
+      auto in = e.row(r);
+      auto out = row_data(r);
+      for (unsigned c = 0; c < cols; c++) {
+        out[c] = in[c];
+      }
+    }
+  }
+
+  T *data;
+  unsigned rows;
+  unsigned cols;
+  size_t stride;
+
+private:
+  void check(unsigned r, unsigned c) const {
+    if (rows != r || cols != c) {
+      throw std::invalid_argument("Invalid arguments");
+    }
+  }
+};
+
+// A simple matrix of T (int, float, uint8_t for an 8-bit image, ...). Its
+// elements are stored row by row in one block that starts on a 64-byte
+// boundary. Arithmetic happens in T, so small types wrap around; use
+// matrix_cast to widen first (or to narrow with clamping).
+template <typename T>
+struct basic_matrix {
+  static_assert(std::is_arithmetic<T>::value, "matrix elements must be numbers");
+  typedef T value_type;
 
-// A simple matrix
-struct matrix {
 public:
-  matrix() : cols(0), rows(0), data(nullptr) {}
+  basic_matrix() : data(nullptr), cols(0), rows(0) {}
 
-  matrix(int c, int r) : cols(c), rows(r), data(nullptr) {}
+  basic_matrix(int c, int r) : data(nullptr), cols(c), rows(r) {}
 
-  matrix(matrix &&x) : matrix() {
+  basic_matrix(basic_matrix &&x) noexcept : basic_matrix() {
     std::swap(cols, x.cols);
     std::swap(rows, x.rows);
     std::swap(data, x.data);
   }
 
-  matrix(const matrix &x) : matrix() {
-    create(x.rows, x.cols);
-    memcpy(data, x.data, rows * cols * sizeof(int));
+  basic_matrix(const basic_matrix &x) : basic_matrix() {
+    allocate(x.rows, x.cols);
+    memcpy(data, x.data, static_cast<size_t>(rows) * cols * sizeof(T));
   }
 
-  ~matrix() {
+  // A copy of what a view shows
+  explicit basic_matrix(matrix_view<const T> x) : basic_matrix() {
+    allocate(x.rows, x.cols);
+    view().assign(x);
+  }
+
+  ~basic_matrix() {
     if (data) {
-      delete[] data;
+      cs477::details::aligned_free(data);
     }
   }
 
-  matrix &operator=(matrix &&x) {
-    this->~matrix();
-    new (this) matrix(std::move(x));
+  basic_matrix &operator=(basic_matrix &&x) noexcept {
+    this->~basic_matrix();
+    new (this) basic_matrix(std::move(x));
     return *this;
   }
 
-  matrix &operator=(const matrix &x) {
-    this->~matrix();
-    new (this) matrix(x);
+  basic_matrix &operator=(const basic_matrix &x) {
+    if (this != &x) {
+      this->~basic_matrix();
+      new (this) basic_matrix(x);
+    }
     return *this;
   }
 
-  void create(unsigned r, unsigned c) {
-    rows = r;
-    cols = c;
-    data = new int[rows * cols];
+  // Works out an elementwise expression (a + b * 2, ...; see expression.hpp)
+  // in one pass over the new matrix
+  template <typename E, typename = typename E::expression_tag>
+  basic_matrix(const E &e) : basic_matrix() {
+    allocate(e.rows(), e.cols());
+    apply(e, [](T &z, T x) { z = x; });
+  }
 
-    auto size = rows * cols;
-    for (unsigned i = 0; i < size; i++) {
-      data[i] = 0;
+  // In place when the sizes match: each element is read before it is
+  // written, so the expression may use this matrix too (a = a + b)
+  template <typename E, typename = typename E::expression_tag>
+  basic_matrix &operator=(const E &e) {
+    if (rows != e.rows() || cols != e.cols()) {
+      return *this = basic_matrix(e);
     }
+    apply(e, [](T &z, T x) { z = x; });
+    return *this;
   }
 
-  int operator()(int r, int c) const {
+  // Allocates (zeroed) storage for r x c elements, dropping anything held
+  void create(unsigned r, unsigned c) {
+    allocate(r, c);
+    memset(data, 0, static_cast<size_t>(rows) * cols * sizeof(T));
+  }
+
+  // The whole matrix as a view, and parts of it (see matrix_view)
+  matrix_view<T> view() {
+    return matrix_view<T>(data, rows, cols, cols);
+  }
+
+  matrix_view<const T> view() const {
+    return matrix_view<const T>(data, rows, cols, cols);
+  }
+
+  operator matrix_view<T>() {
+    return view();
+  }
+
+  operator matrix_view<const T>() const {
+    return view();
+  }
+
+  matrix_view<T> submatrix(unsigned r, unsigned c, unsigned h, unsigned w) {
+    return view().submatrix(r, c, h, w);
+  }
+
+  matrix_view<const T> submatrix(unsigned r, unsigned c, unsigned h, unsigned w) const {
+    return view().submatrix(r, c, h, w);
+  }
+
+  matrix_view<T> tile(unsigned i, unsigned j, unsigned h, unsigned w) {
+    return view().tile(i, j, h, w);
+  }
+
+  matrix_view<const T> tile(unsigned i, unsigned j, unsigned h, unsigned w) const {
+    return view().tile(i, j, h, w);
+  }
+
+  matrix_view<T> row(unsigned r) {
+    return view().row(r);
+  }
+
+  matrix_view<const T> row(unsigned r) const {
+    return view().row(r);
+  }
+
+  matrix_view<T> col(unsigned c) {
+    return view().col(c);
+  }
+
+  matrix_view<const T> col(unsigned c) const {
+    return view().col(c);
+  }
+
+  T operator()(int r, int c) const {
     return data[r * cols + c];
   }
 
-  int &operator()(int r, int c) {
+  T &operator()(int r, int c) {
     return data[r * cols + c];
   }
 
-  matrix &operator+=(int s) {
+  basic_matrix &operator+=(const basic_matrix &x) {
+    check(x.rows, x.cols);
+    auto size = static_cast<size_t>(rows) * cols;
+    for (size_t i = 0; i < size; i++) {
+      data[i] += x.data[i];
+    }
+    return *this;
+  }
+
+  basic_matrix &operator-=(const basic_matrix &x) {
+    check(x.rows, x.cols);
+    auto size = static_cast<size_t>(rows) * cols;
+    for (size_t i = 0; i < size; i++) {
+      data[i] -= x.data[i];
+    }
+    return *this;
+  }
+
+  template <typename E, typename = typename E::expression_tag>
+  basic_matrix &operator+=(const E &e) {
+    check(e.rows(), e.cols());
+    apply(e, [](T &z, T x) { z += x; });
+    return *this;
+  }
+
+  template <typename E, typename = typename E::expression_tag>
+  basic_matrix &operator-=(const E &e) {
+    check(e.rows(), e.cols());
+    apply(e, [](T &z, T x) { z -= x; });
+    return *this;
+  }
+
+  basic_matrix &operator+=(T s) {
     auto ptr = data;
     auto end = ptr + rows * cols;
     while (ptr != end) {
@@ -67,7 +349,7 @@ public:
     return *this;
   }
 
-  matrix &operator-=(int s) {
+  basic_matrix &operator-=(T s) {
     auto ptr = data;
     auto end = ptr + rows * cols;
     while (ptr != end) {
@@ -77,7 +359,7 @@ public:
     return *this;
   }
 
-  matrix &operator*=(int s) {
+  basic_matrix &operator*=(T s) {
     auto ptr = data;
     auto end = ptr + rows * cols;
     while (ptr != end) {
@@ -87,7 +369,7 @@ public:
     return *this;
   }
 
-  matrix &operator/=(int s) {
+  basic_matrix &operator/=(T s) {
     auto ptr = data;
     auto end = ptr + rows * cols;
     while (ptr != end) {
@@ -97,67 +379,77 @@ public:
     return *this;
   }
 
-  int *data;
+  T *data;
   unsigned cols;
   unsigned rows;
-};
-
-matrix operator+(const matrix &x, const matrix &y) {
-  if (x.rows != y.rows || x.cols != y.cols) {
-    throw std::invalid_argument("Invalid arguments");
-  }
 
-  matrix z;
-  z.create(x.rows, y.cols);
-
-  for (unsigned i = 0; i < x.rows; i++) {
-    for (unsigned j = 0; j < y.cols; j++) {
-      z(i, j) = x(i, j) + y(i, j);
+private:
+  // Like create(), without zeroing: for results about to be overwritten
+  void allocate(unsigned r, unsigned c) {
+    if (data) {
+      cs477::details::aligned_free(data);
+      data = nullptr;
     }
+    rows = r;
+    cols = c;
+    data = static_cast<T *>(cs477::details::aligned_allocate(static_cast<size_t>(rows) * cols * sizeof(T)));
   }
 
-  return z;
-}
-
-matrix operator-(const matrix &x, const matrix &y) {
-  if (x.rows != y.rows || x.cols != y.cols) {
-    throw std::invalid_argument("Invalid arguments");
+  void check(unsigned r, unsigned c) const {
+    if (rows != r || cols != c) {
+      throw std::invalid_argument("Invalid arguments");
+    }
   }
 
-  matrix z;
-  z.create(x.rows, y.cols);
-
-  for (unsigned i = 0; i < x.rows; i++) {
-    for (unsigned j = 0; j < y.cols; j++) {
-      z(i, j) = x(i, j) - y(i, j);
+  // op(element, value) for every element, a row of the expression at a time
+  template <typename E, typename Op>
+  void apply(const E &e, Op op) {
+    for (unsigned r = 0; r < rows; r++) {
+      auto in = e.row(r);
+      auto out = data + static_cast<size_t>(r) * cols;
+      for (unsigned c = 0; c < cols; c++) {
+        op(out[c], in[c]);
+      }
     }
   }
+};
 
-  return z;
-}
+typedef basic_matrix<int> matrix;
+// An 8-bit grayscale image: a quarter of the bytes of a matrix
+typedef basic_matrix<uint8_t> byte_matrix;
 
-#if !OVERRIDE_MATRIX_MULT
-matrix operator*(const matrix &x, const matrix &y) {
-  if (x.cols != y.rows) {
-    throw std::invalid_argument("Invalid arguments");
+// Copies x into a matrix of another element type, clamping values that
+// don't fit (see cs477::saturate_cast)
+template <typename To, typename From>
+basic_matrix<To> matrix_cast(const basic_matrix<From> &x) {
+  basic_matrix<To> y;
+  y.create(x.rows, x.cols);
+  auto size = static_cast<size_t>(x.rows) * x.cols;
+  for (size_t i = 0; i < size; i++) {
+    y.data[i] = cs477::saturate_cast<To>(x.data[i]);
   }
+  return y;
+}
 
-  matrix z;
-  z.create(x.rows, y.cols);
-
-  for (unsigned i = 0; i < x.rows; i++) {
-    for (unsigned j = 0; j < y.cols; j++) {
-      int zz = 0;
-      for (unsigned k = 0; k < x.cols; k++) {
-        zz += x(i, k) * y(k, j);
-      }
+namespace cs477 {
+template <typename T>
+basic_matrix<T> multiply(const basic_matrix<T> &x, const basic_matrix<T> &y);
 
-      z(i, j) = zz;
-    }
-  }
+template <typename T, typename U>
+basic_matrix<typename std::remove_const<T>::type> multiply(matrix_view<T> x, matrix_view<U> y);
+}
 
-  return z;
+#if !OVERRIDE_MATRIX_MULT
+// Cache-blocked and vectorized, on the calling thread (see gemm.hpp for the
+// multiply that runs on a Pool). Byte and short products are summed as ints
+// and clamped at the end.
+template <typename T>
+basic_matrix<T> operator*(const basic_matrix<T> &x, const basic_matrix<T> &y) {
+  return cs477::multiply(x, y);
 }
 #endif
 
+#include "expression.hpp"
+#include "gemm.hpp"
+
 #endif
@@ -13,6 +13,8 @@
 #include <memory>
 #include <future>
 #include <cstdio>
+#include "future.hpp"
+#include "trace.hpp"
 #pragma comment(lib, "ws2_32.lib")
 
 namespace cs477 {
@@ -59,7 +61,8 @@ public:
 
   overlapped ol;
   std::string buf;
-  std::promise<void> promise;
+  cs477::promise<void> promise;
+  TRACE_ONLY(uint64_t started = cs477::trace::ticks();)
 };
 
 class async_recv {
@@ -72,7 +75,8 @@ public:
 
   overlapped ol;
   std::string buf;
-  std::promise<std::string> promise;
+  cs477::promise<std::string> promise;
+  TRACE_ONLY(uint64_t started = cs477::trace::ticks();)
 };
 
 class socket {
@@ -144,7 +148,7 @@ private:
   }
 
 public:
-  std::future<void> send(const char *buf, uint32_t len) {
+  cs477::future<void> send(const char *buf, uint32_t len) {
     auto op = new async_send();
     op->buf = {buf, len};
     auto f = op->promise.get_future();
@@ -152,8 +156,9 @@ public:
     addref();
     StartThreadpoolIo(io);
 
+    // Send our copy; the caller's buffer may be gone before this completes
     WSABUF wsabuf;
-    wsabuf.buf = const_cast<char *>(buf);
+    wsabuf.buf = &op->buf.front();
     wsabuf.len = len;
     auto result = WSASend(handle, &wsabuf, 1, nullptr, 0, &op->ol.ol, nullptr);
     if (result == SOCKET_ERROR) {
@@ -169,7 +174,7 @@ public:
     return f;
   }
 
-  std::future<std::string> recv(uint32_t len) {
+  cs477::future<std::string> recv(uint32_t len) {
     auto op = new async_recv(len);
 
     auto f = op->promise.get_future();
@@ -200,24 +205,27 @@ private:
     auto ol = (overlapped *) Overlapped;
     auto sock = (socket *) Context;
 
+    // Completing the promise runs its continuations right here, on the I/O
+    // thread, so nobody has to sit blocked on the result
     if (ol->type == overlapped::recv) {
       auto recv = reinterpret_cast<async_recv *>(ol);
+      // From WSARecv to completion, before any continuation runs
+      TRACE_ONLY(cs477::trace::complete("socket recv", recv->started, "bytes", NumberOfBytesTransferred));
       if (IoResult || !NumberOfBytesTransferred) {
-        recv->promise.set_exception(std::make_exception_ptr(std::exception{}));
-      }
-      recv->buf.resize(NumberOfBytesTransferred);
-      try {
+        recv->promise.set_exception(std::make_exception_ptr(std::system_error(IoResult ? IoResult : WSAECONNRESET, std::system_category())));
+      } else {
+        recv->buf.resize(NumberOfBytesTransferred);
         recv->promise.set_value(std::move(recv->buf));
-      } catch (...) {
-        puts("There seems to be a very rare bug in your code, Mr. Sutton! I'm just going to absorb it here.");
       }
       delete recv;
     } else if (ol->type == overlapped::send) {
       auto send = reinterpret_cast<async_send *>(ol);
+      TRACE_ONLY(cs477::trace::complete("socket send", send->started, "bytes", NumberOfBytesTransferred));
       if (IoResult || !NumberOfBytesTransferred) {
-        send->promise.set_exception(std::make_exception_ptr(std::exception{}));
+        send->promise.set_exception(std::make_exception_ptr(std::system_error(IoResult ? IoResult : WSAECONNRESET, std::system_category())));
+      } else {
+        send->promise.set_value();
       }
-      send->promise.set_value();
       delete send;
     } else if (ol->type == overlapped::accept) {
       auto accept = reinterpret_cast<async_accept *>(ol);
@@ -280,8 +288,8 @@ public:
   uint32_t recv(char *buf, uint32_t len);
 
 public:
-  std::future<void> send_async(const char *buf, uint32_t len);
-  std::future<std::string> recv_async();
+  cs477::future<void> send_async(const char *buf, uint32_t len);
+  cs477::future<std::string> recv_async();
 
 private:
   details::socket *sock;
@@ -401,6 +409,7 @@ inline void socket::send(const char *buf, uint32_t len) {
     throw std::system_error(WSAENOTSOCK, std::system_category());
   }
 
+  TRACE_SPAN("socket send", "bytes", len);
   auto ptr = buf;
   auto end = buf + len;
 
@@ -419,6 +428,7 @@ inline uint32_t socket::recv(char *buf, uint32_t len) {
     throw std::exception();
   }
 
+  TRACE_SPAN("socket recv");
   auto recvd = ::recv(sock->handle, buf, static_cast<int>(len), 0);
   if (recvd == SOCKET_ERROR || recvd == 0) {
     throw std::system_error(GetLastError(), std::system_category());
@@ -427,7 +437,7 @@ inline uint32_t socket::recv(char *buf, uint32_t len) {
   return static_cast<uint32_t>(recvd);
 }
 
-inline std::future<void> socket::send_async(const char *buf, uint32_t len) {
+inline cs477::future<void> socket::send_async(const char *buf, uint32_t len) {
   if (!sock) {
     throw std::system_error(WSAENOTSOCK, std::system_category());
   }
@@ -435,7 +445,7 @@ inline std::future<void> socket::send_async(const char *buf, uint32_t len) {
   return sock->send(buf, len);
 }
 
-inline std::future<std::string> socket::recv_async() {
+inline cs477::future<std::string> socket::recv_async() {
   if (!sock) {
     throw std::system_error(WSAENOTSOCK, std::system_category());
   }
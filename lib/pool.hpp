@@ -1,141 +1,1209 @@
 #ifndef POOL_HPP
 #define POOL_HPP
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
 #include <deque>
+#include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
+#include "cancel.hpp"
+#include "future.hpp"
+#include "job.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+
+//Build with POOL_STATS defined to true to collect per-worker counters (see
+//Pool::stats). Without it the counting code isn't compiled at all.
+#ifndef POOL_STATS
+#define POOL_STATS false
+#endif
+
+#if POOL_STATS
+#define POOL_STAT(...) __VA_ARGS__
+#else
+#define POOL_STAT(...)
+#endif
+
+//How a pool hands out work to its threads
+enum class pool_mode {
+  //Every job goes through one FIFO queue shared by all workers
+  shared,
+  //Every worker owns a deque; jobs submitted from inside a worker stay on that
+  //worker (LIFO) and idle workers steal the oldest jobs from everybody else
+  work_stealing,
+};
+
+//How parallel_for splits its range
+enum class schedule {
+  //Fixed chunks decided up front: one even block per thread, or grain-sized
+  //chunks dealt out round robin
+  static_blocks,
+  //Threads claim grain-sized chunks from a shared counter as they free up
+  dynamic,
+  //Like dynamic, but chunks start large and shrink towards grain
+  guided,
+  //Like static_blocks with no grain, but block i always runs on worker i.
+  //On a pinned pool that keeps each block next to the memory it first
+  //touched (see Pool::first_touch).
+  affinity,
+};
+
+//What Pool::shutdown does with work that hasn't started yet
+enum class shutdown_mode {
+  //Run all of it (and whatever it spawns) first
+  drain,
+  //Drop submitted jobs; their futures throw cs477::operation_cancelled
+  discard,
+};
+
+//Queues a pool serves in order of preference
+enum class priority {
+  //Latency-sensitive work (e.g. request handling); always served first
+  interactive,
+  normal,
+  //Bulk work that only runs when nothing else is waiting
+  background,
+};
+
+//Snapshot of one priority lane
+struct lane_stats {
+  //Jobs waiting in the lane right now
+  int depth;
+  //Jobs taken off the lane so far
+  long long dequeued;
+  //Time those jobs spent queued
+  double average_wait_ms;
+  double max_wait_ms;
+};
+
+//Counters for one worker, or for all threads outside the pool put together.
+//Only collected when built with POOL_STATS; they read zero otherwise.
+struct worker_stats {
+  //Jobs this thread queued
+  long long submitted;
+  //Jobs this thread ran, and how many of them it stole from other workers
+  long long completed;
+  long long steals;
+  //Times this thread went to sleep for lack of work and was woken again
+  long long wakes;
+  //How long the jobs it ran sat in a queue, how long they ran, and how
+  //long it slept
+  double queued_ms;
+  double running_ms;
+  double idle_ms;
+};
+
+//Point-in-time view of a pool, cheap enough to dump from a live server
+struct pool_stats {
+  std::vector<worker_stats> workers;
+  worker_stats outside;
+  lane_stats lanes[3];
+  //Jobs queued but not yet started
+  int pending;
+
+  worker_stats total() const {
+    worker_stats t = outside;
+    for (auto& w : workers) {
+      t.submitted += w.submitted;
+      t.completed += w.completed;
+      t.steals += w.steals;
+      t.wakes += w.wakes;
+      t.queued_ms += w.queued_ms;
+      t.running_ms += w.running_ms;
+      t.idle_ms += w.idle_ms;
+    }
+    return t;
+  }
+
+  void print(FILE* out = stdout) const {
+    const char* NAMES[] = {"interactive", "normal", "background"};
+    fprintf(out, "%-8s %10s %10s %8s %8s %12s %12s %12s\n", "worker", "submitted", "completed", "steals", "wakes", "queued ms", "running ms", "idle ms");
+    auto row = [out](const char* name, const worker_stats& w) {
+      fprintf(out, "%-8s %10lld %10lld %8lld %8lld %12.1f %12.1f %12.1f\n", name, w.submitted, w.completed, w.steals, w.wakes, w.queued_ms, w.running_ms, w.idle_ms);
+    };
+    char name[16];
+    for (size_t i = 0; i < workers.size(); ++i) {
+      snprintf(name, sizeof(name), "%d", static_cast<int>(i));
+      row(name, workers[i]);
+    }
+    row("outside", outside);
+    row("total", total());
+    fprintf(out, "%d pending\n", pending);
+    for (int i = 0; i < 3; ++i) {
+      fprintf(out, "%-12s depth %6d dequeued %10lld wait avg %8.2f ms max %8.2f ms\n", NAMES[i], lanes[i].depth, lanes[i].dequeued, lanes[i].average_wait_ms, lanes[i].max_wait_ms);
+    }
+  }
+};
+
+//Why an elastic pool changed size
+enum class resize_reason {
+  //Jobs were queuing up with no worker free to take them
+  backlog,
+  //A worker went into Pool::blocking() while there was work queued
+  blocked,
+  //A schedule::affinity job was posted to a worker that had retired
+  affinity,
+  //A worker sat idle for pool_options::idle_timeout and retired
+  idle,
+};
+
+struct resize_event {
+  //Live worker threads after the change
+  int threads;
+  resize_reason reason;
+};
+
+//Everything a Pool can be configured with
+struct pool_options {
+  //Number of workers; 0 sizes the pool from the topology (one per core)
+  int threads = 0;
+  pool_mode mode = pool_mode::shared;
+  //Pin worker i to the i-th CPU of topology::placement(), so workers don't
+  //migrate and the first workers are spread over cores and NUMA nodes
+  bool pin = false;
+  //A normal or background job that has waited this long is served ahead of
+  //higher lanes, so a steady stream of interactive work can't starve it
+  std::chrono::milliseconds aging = std::chrono::milliseconds(100);
+  //When above `threads` the pool is elastic: `threads` workers start and
+  //always stay, and more (up to max_threads) are started while jobs back up
+  //or workers are stuck in Pool::blocking(). Extras retire after sitting idle
+  //for idle_timeout. size() is max_threads; thread_count() is what's live.
+  int max_threads = 0;
+  std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(2000);
+  //Don't start threads more often than this, so a burst of submits doesn't
+  //jump straight to max_threads
+  std::chrono::milliseconds grow_interval = std::chrono::milliseconds(1);
+  //Called after every resize, from whichever thread caused it
+  std::function<void(const resize_event&)> on_resize;
+};
 
-//TODO: reject submit when pool is shutdown
 class Pool {
 private:
-  //Count of threads in the pool
+  //A job and when it was queued (lanes always stamp it, worker deques only
+  //with POOL_STATS)
+  struct queued {
+    cs477::job job;
+    std::chrono::steady_clock::time_point at;
+    //For the trace: how long the job sat in a queue
+    TRACE_ONLY(uint64_t enqueued = cs477::trace::ticks();)
+  };
+
+  //A double-ended FIFO of jobs on a ring that only ever grows. std::deque
+  //allocates (and frees) a block every few pushes as jobs flow through it;
+  //this reuses its slots, so once it has grown to a queue's usual depth,
+  //queueing a job doesn't touch the heap. Popped slots keep a moved-from
+  //(empty) job.
+  class job_queue {
+  public:
+    job_queue() : slots(16) {}
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    queued& front() { return slots[head]; }
+    queued& back() { return slots[(head + count - 1) & (slots.size() - 1)]; }
+
+    void push_back(queued&& q) {
+      if (count == slots.size()) grow();
+      slots[(head + count) & (slots.size() - 1)] = std::move(q);
+      count++;
+    }
+
+    void pop_front() {
+      head = (head + 1) & (slots.size() - 1);
+      count--;
+    }
+
+    void pop_back() {
+      count--;
+    }
+
+  private:
+    void grow() {
+      std::vector<queued> bigger(slots.size() * 2);
+      for (size_t i = 0; i < count; ++i) bigger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+      slots.swap(bigger);
+      head = 0;
+    }
+
+    //A power of two long
+    std::vector<queued> slots;
+    size_t head = 0;
+    size_t count = 0;
+  };
+
+  //Raw POOL_STATS counters, in nanoseconds
+  struct counters {
+    std::atomic<long long> submitted{0}, completed{0}, steals{0}, wakes{0};
+    std::atomic<long long> queued{0}, running{0}, idle{0};
+    char pad[64];
+
+    static void add(std::atomic<long long>& c, long long n) {
+      c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void add(std::atomic<long long>& c, std::chrono::steady_clock::duration d) {
+      add(c, static_cast<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    }
+
+    worker_stats snapshot() const {
+      auto ms = [](const std::atomic<long long>& ns) { return ns.load(std::memory_order_relaxed) / 1e6; };
+      return worker_stats{submitted.load(), completed.load(), steals.load(), wakes.load(), ms(queued), ms(running), ms(idle)};
+    }
+  };
+
+  //A worker's private deque (only used when work stealing)
+  struct worker {
+    std::mutex m;
+    job_queue jobs;
+    //Jobs that must run on this worker (schedule::affinity); never stolen
+    job_queue affine;
+    std::atomic<int> affine_count{0};
+    //CPU and NUMA node we're pinned to, or -1
+    int cpu = -1;
+    int node = -1;
+    //Set when the OS wouldn't pin the thread to `cpu`
+    std::atomic<bool> unpinned{false};
+    //Whether this slot has a thread right now (guarded by resize_m)
+    bool alive = false;
+    counters stats;
+  };
+
+  //Keeps per-job values on separate cache lines
+  template <typename T>
+  struct padded {
+    explicit padded(const T& value) : value(value) {}
+    T value;
+    char pad[64];
+  };
+
+  //Which pool (and which worker of it) the current thread belongs to, and
+  //which pool's job it is running right now
+  struct worker_context {
+    Pool *pool;
+    int index;
+    Pool *running;
+  };
+
+  //Count of threads in the pool (worker slots, for an elastic pool)
   int count;
+  //How jobs are distributed between the workers
+  pool_mode mode;
+  //Whether workers are pinned to CPUs
+  bool pinned;
   //Mutex when performing actions on the non-thread-safe STL utilities
   std::mutex m;
   //Stuff for putting threads to sleepy sleepy
   std::mutex m2;
   std::condition_variable cv;
+  //Jobs sitting in any queue, and workers waiting on cv for one to show up
+  std::atomic<int> pending{0};
+  std::atomic<int> sleeping{0};
+  //Threads blocked in help_until; they also need waking when a job finishes
+  std::atomic<int> helpers{0};
   //List of our workers
   std::vector<std::thread> threads;
-  //Whether or not we're accepting tasks
-  std::atomic<bool>* shutdown = new std::atomic<bool>(false);
-  //List of pending jobs waiting to be std::move'd by a worker
-  std::deque<std::future<void>> jobs;
+  std::vector<std::unique_ptr<worker>> workers;
+  //Set once shutdown() starts; after that only code running inside the pool
+  //may queue jobs
+  std::atomic<bool> closed{false};
+  //Set by shutdown_mode::discard: submitted jobs that haven't started are
+  //dropped instead of run
+  std::atomic<bool> discarding{false};
+  //Jobs admitted but not finished yet; shutdown() waits for this to hit 0
+  std::atomic<int> outstanding{0};
+  //Tells the workers to exit, once everything has drained
+  std::atomic<bool>* stopping = new std::atomic<bool>(false);
+  std::mutex lifecycle;
+  //One FIFO per priority, all guarded by m. Jobs submitted from outside the
+  //pool (and anything not `normal`) land here in both modes.
+  struct lane {
+    job_queue jobs;
+    std::atomic<int> depth{0};
+    long long dequeued = 0;
+    std::chrono::steady_clock::duration waited{0};
+    std::chrono::steady_clock::duration max_wait{0};
+  };
+  lane lanes[3];
+  std::chrono::steady_clock::duration aging = std::chrono::milliseconds(100);
+  //Counters for threads that aren't our workers
+  counters outside;
+  //Elastic pools only keep `live` of their slots running (see
+  //pool_options::max_threads); resize_m guards starting and retiring them
+  bool elastic = false;
+  int min_live = 0;
+  std::atomic<int> live{0};
+  //Workers inside blocking()
+  std::atomic<int> blocked{0};
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::milliseconds(2000);
+  std::chrono::steady_clock::duration grow_interval = std::chrono::milliseconds(1);
+  std::atomic<std::chrono::steady_clock::rep> last_grow{0};
+  std::function<void(const resize_event&)> on_resize;
+  std::mutex resize_m;
+
+  //Counts down the chunks of a parallel_for; keeps the first exception thrown
+  struct latch {
+    std::atomic<int> remaining;
+    std::mutex m;
+    std::exception_ptr error;
+
+    explicit latch(int count) : remaining(count) {}
+
+    void count_down(std::exception_ptr e = nullptr) {
+      if (e) {
+        std::lock_guard<std::mutex> lock(m);
+        if (!error) error = e;
+      }
+      remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool ready() const {
+      return remaining.load(std::memory_order_acquire) == 0;
+    }
+
+    void rethrow() {
+      if (error) std::rethrow_exception(error);
+    }
+  };
+
+  static worker_context& current() {
+    static thread_local worker_context ctx{nullptr, -1, nullptr};
+    return ctx;
+  }
+
+  //Runs body(0) .. body(jobs - 1) on the pool (the calling thread helps) and
+  //returns once all of them finish. The jobs only borrow body and the latch,
+  //so each fits inside a job without allocating. With `affine`, job i is
+  //reserved for worker i.
+  template <typename Body>
+  void run_chunks(std::ptrdiff_t jobs, const Body& body, bool affine = false) {
+    admit(static_cast<int>(jobs));
+    latch done(static_cast<int>(jobs));
+    for (std::ptrdiff_t i = 0; i < jobs; ++i) {
+      cs477::job f([i, &body, &done]() {
+        try {
+          body(i);
+          done.count_down();
+        } catch (...) {
+          done.count_down(std::current_exception());
+        }
+      });
+      if (affine) {
+        post_to(static_cast<int>(i % count), std::move(f));
+      } else {
+        push(std::move(f));
+      }
+    }
+    help_until([&done]() { return done.ready(); });
+    done.rethrow();
+  }
+
+  //Counts `jobs` new jobs towards `outstanding`, or throws if the pool is
+  //shutting down and the caller isn't running inside it. Counting first means
+  //shutdown() either sees the jobs or we see it closing.
+  void admit(int jobs) {
+    outstanding.fetch_add(jobs);
+    auto& ctx = current();
+    if (closed.load() && ctx.pool != this && ctx.running != this) {
+      outstanding.fetch_sub(jobs);
+      throw std::runtime_error("pool is shut down");
+    }
+  }
+
+  //A submitted job: dropped instead of run once its token fires or the pool
+  //is discarding
+  template <typename S>
+  struct guarded {
+    cs477::details::run_task<S> task;
+    cs477::cancel_token token;
+    const std::atomic<bool>* discarding;
+
+    void operator()() {
+      if (discarding->load(std::memory_order_relaxed) || token.cancelled()) {
+        task.cancel(std::make_exception_ptr(cs477::operation_cancelled()));
+      } else {
+        task();
+      }
+    }
+  };
 
-  void provision() {
+  counters& counters_for(int index) {
+    return index >= 0 ? workers[index]->stats : outside;
+  }
+
+  static std::chrono::steady_clock::time_point stamp() {
+#if POOL_STATS
+    return std::chrono::steady_clock::now();
+#else
+    return std::chrono::steady_clock::time_point();
+#endif
+  }
+
+  //Runs a job, then wakes anyone in help_until that might have been waiting
+  //on it
+  void run(queued& q, int index) {
+    (void)index; //Only the stats use it
+    POOL_STAT(auto& c = counters_for(index));
+    POOL_STAT(auto started = std::chrono::steady_clock::now());
+    POOL_STAT(if (q.at != std::chrono::steady_clock::time_point()) counters::add(c.queued, started - q.at));
+    auto& ctx = current();
+    auto outer = ctx.running;
+    ctx.running = this;
+    {
+      TRACE_SPAN("pool job", "queued_us", cs477::trace::since(q.enqueued));
+      q.job();
+    }
+    q.job.reset();
+    ctx.running = outer;
+    outstanding.fetch_sub(1, std::memory_order_release);
+    POOL_STAT(counters::add(c.running, std::chrono::steady_clock::now() - started));
+    POOL_STAT(counters::add(c.completed, 1));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (helpers.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(m2);
+      cv.notify_all();
+    }
+  }
+
+  void provision(int initial) {
     //Lock while we create our threads (do you really think someone will try deleting us that fast? :sad_face:)
-    m.lock();
+    std::lock_guard<std::mutex> lock(resize_m);
+    auto cpus = cs477::topology::get().placement();
     for (int i = 0; i < count; ++i) {
-      //Create a thread bound to the object which owns this pool object (because why not?)
-      threads.push_back(std::move(std::thread(&Pool::create_worker, this)));
+      workers.emplace_back(new worker);
+      if (pinned && !cpus.empty()) {
+        workers[i]->cpu = cpus[i % cpus.size()];
+        workers[i]->node = cs477::topology::get().find(workers[i]->cpu)->node;
+      }
+    }
+    threads.resize(count);
+    for (int i = 0; i < initial; ++i) start_worker(i);
+  }
+
+  //Gives slot i a thread; resize_m must be held
+  void start_worker(int i) {
+    //A thread that retired from this slot may still be on its way out
+    if (threads[i].joinable()) threads[i].join();
+    workers[i]->alive = true;
+    ++live;
+    //Create a thread bound to the object which owns this pool object (because why not?)
+    threads[i] = std::thread(&Pool::create_worker, this, i);
+  }
+
+  void resized(int threads, resize_reason why) {
+    if (on_resize) on_resize(resize_event{threads, why});
+  }
+
+  //Starts one more worker, in slot i if given (and dead) or any dead slot
+  void grow(resize_reason why, int i = -1) {
+    int n;
+    {
+      std::lock_guard<std::mutex> lock(resize_m);
+      if (stopping->load()) return;
+      if (i < 0) {
+        for (int j = 0; j < count && i < 0; ++j) {
+          if (!workers[j]->alive) i = j;
+        }
+        if (i < 0) return;
+      } else if (workers[i]->alive) {
+        return;
+      }
+      start_worker(i);
+      n = live.load();
+    }
+    resized(n, why);
+  }
+
+  //Called when a job is queued: grow an elastic pool if nobody is free to
+  //take it and the queue is deeper than the workers that aren't blocked
+  void maybe_grow() {
+    if (!elastic || sleeping.load() > 0) return;
+    auto running = live.load() - blocked.load();
+    if (live.load() >= count || pending.load() <= running) return;
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto last = last_grow.load();
+    if (now - last < grow_interval.count() || !last_grow.compare_exchange_strong(last, now)) return;
+    grow(resize_reason::backlog);
+  }
+
+  //An elastic worker that timed out waiting for work; false if it should
+  //stay after all
+  bool retire(int index) {
+    auto& self = *workers[index];
+    int n;
+    {
+      std::lock_guard<std::mutex> lock(resize_m);
+      if (stopping->load() || live.load() <= min_live || self.affine_count.load() > 0) return false;
+      self.alive = false;
+      n = --live;
+    }
+    resized(n, resize_reason::idle);
+    return true;
+  }
+
+  //Pops the front of a lane; m must be held
+  void take_lane(lane& l, queued& f, std::chrono::steady_clock::time_point now) {
+    auto waited = now - l.jobs.front().at;
+    f = std::move(l.jobs.front());
+    l.jobs.pop_front();
+    --l.depth;
+    --pending;
+    l.dequeued++;
+    l.waited += waited;
+    if (waited > l.max_wait) l.max_wait = waited;
+  }
+
+  //Serves anything that has waited past `aging` first (lowest lane first),
+  //then the highest non-empty lane down to `last`
+  bool take_lanes(priority last, queued& f) {
+    if (lanes[0].depth.load() + lanes[1].depth.load() + lanes[2].depth.load() == 0) return false;
+    std::lock_guard<std::mutex> lock(m);
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 2; i > 0; --i) {
+      if (!lanes[i].jobs.empty() && now - lanes[i].jobs.front().at >= aging) {
+        take_lane(lanes[i], f, now);
+        return true;
+      }
+    }
+    for (int i = 0; i <= static_cast<int>(last); ++i) {
+      if (!lanes[i].jobs.empty()) {
+        take_lane(lanes[i], f, now);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //Our own affinity jobs first, then the lanes and (when work stealing) our
+  //own deque, then everyone else's deque; index is -1 for outside threads
+  bool take(int index, queued& f) {
+    if (index >= 0 && workers[index]->affine_count.load() > 0) {
+      auto& self = *workers[index];
+      std::lock_guard<std::mutex> lock(self.m);
+      if (!self.affine.empty()) {
+        f = std::move(self.affine.front());
+        self.affine.pop_front();
+        --self.affine_count;
+        return true;
+      }
+    }
+    if (mode == pool_mode::shared) return take_lanes(priority::background, f);
+    //Interactive (and overdue) work beats our own backlog
+    if (take_lanes(priority::interactive, f)) return true;
+    if (index >= 0) {
+      auto& self = *workers[index];
+      std::lock_guard<std::mutex> lock(self.m);
+      if (!self.jobs.empty()) {
+        f = std::move(self.jobs.back());
+        self.jobs.pop_back();
+        --pending;
+        return true;
+      }
+    }
+    if (take_lanes(priority::normal, f)) return true;
+    for (int i = index < 0 ? 0 : 1; i < count; ++i) {
+      auto& victim = *workers[(index + i + count) % count];
+      std::lock_guard<std::mutex> lock(victim.m);
+      if (!victim.jobs.empty()) {
+        f = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        --pending;
+        POOL_STAT(counters::add(counters_for(index).steals, 1));
+        return true;
+      }
+    }
+    //Background work only once nobody has anything better
+    return take_lanes(priority::background, f);
+  }
+
+  void push(cs477::job&& f, priority p = priority::normal) {
+    auto& ctx = current();
+    if (mode == pool_mode::work_stealing && ctx.pool == this && p == priority::normal) {
+      auto& self = *workers[ctx.index];
+      std::lock_guard<std::mutex> lock(self.m);
+      self.jobs.push_back(queued{std::move(f), stamp()});
+      ++pending;
+    } else {
+      auto& l = lanes[static_cast<int>(p)];
+      std::lock_guard<std::mutex> lock(m);
+      l.jobs.push_back(queued{std::move(f), std::chrono::steady_clock::now()});
+      ++l.depth;
+      ++pending;
+    }
+    POOL_STAT(counters::add(counters_for(ctx.pool == this ? ctx.index : -1).submitted, 1));
+    //Sleepers bump `sleeping` before re-checking `pending` under m2, so either
+    //they see our job or we see them and take m2 to wake one
+    if (sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(m2);
+      cv.notify_one();
+    } else {
+      maybe_grow();
     }
-    m.unlock();
   }
 
-  void create_worker() {
+  //Queues a job that only worker `index` may run. Doesn't count towards
+  //`pending`, since nobody else can help with it.
+  void post_to(int index, cs477::job&& f) {
+    auto& w = *workers[index];
+    {
+      std::lock_guard<std::mutex> lock(w.m);
+      w.affine.push_back(queued{std::move(f), stamp()});
+      ++w.affine_count;
+    }
+    POOL_STAT(counters::add(counters_for(worker_index()).submitted, 1));
+    //Nobody else can run it, so a retired worker has to come back for it
+    if (elastic) grow(resize_reason::affinity, index);
+    if (sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(m2);
+      cv.notify_all();
+    }
+  }
+
+  void create_worker(int index) {
+    current() = {this, index, nullptr};
+    TRACE_ONLY(cs477::trace::name_thread("pool worker " + std::to_string(index)));
+    auto& self = *workers[index];
+    if (self.cpu >= 0 && !cs477::pin_current_thread(self.cpu)) {
+      self.unpinned = true;
+      fprintf(stderr, "pool: could not pin worker %d to CPU %d\n", index, self.cpu);
+    }
+    queued f;
     for (;;) {
-      //Die if we're shutting down
-      if (shutdown->load()) break;
-      //Lock the mutex and check for work
-      m.lock();
-      if (jobs.empty()) {
-        //No work, go (back) to sleep!
-        m.unlock();
-
-        std::unique_lock<std::mutex> lock(m2);
-        cv.wait(lock);
-      } else {
+      //Die once shutdown() has drained everything
+      if (stopping->load()) break;
+      if (take(index, f)) {
         //Ermahgerd we have work! Leggo.
-        auto f = std::move(jobs.front());
-        jobs.pop_front();
-        m.unlock();
+        run(f, index);
+        continue;
+      }
+      //No work, go (back) to sleep!
+      std::unique_lock<std::mutex> lock(m2);
+      ++sleeping;
+      POOL_STAT(auto slept = std::chrono::steady_clock::now());
+      auto woken = [&]() { return stopping->load() || pending.load() > 0 || self.affine_count.load() > 0; };
+      bool idle = false;
+      if (elastic) {
+        idle = !cv.wait_for(lock, idle_timeout, woken);
+      } else {
+        cv.wait(lock, woken);
+      }
+      POOL_STAT(counters::add(self.stats.idle, std::chrono::steady_clock::now() - slept));
+      POOL_STAT(counters::add(self.stats.wakes, 1));
+      --sleeping;
+      lock.unlock();
+      //Been idle too long? Leave, unless we're one of the minimum
+      if (idle && retire(index)) break;
+    }
+  }
 
-        f.get();
+  //Instead of blocking, run queued jobs until ready() is true. Nobody sits
+  //idle on a child's result and a recursion deeper than the pool can't
+  //deadlock it. With nothing to run we sleep until a job is queued or
+  //finishes (or a short timeout, for results set outside the pool).
+  template <typename Ready>
+  void help_until(Ready ready) {
+    const int index = worker_index();
+    queued f;
+    while (!ready()) {
+      if (take(index, f)) {
+        run(f, index);
+        continue;
       }
+      std::unique_lock<std::mutex> lock(m2);
+      ++sleeping;
+      ++helpers;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      POOL_STAT(auto slept = std::chrono::steady_clock::now());
+      cv.wait_for(lock, std::chrono::milliseconds(1), [&]() { return stopping->load() || pending.load() > 0 || ready(); });
+      POOL_STAT(counters::add(counters_for(index).idle, std::chrono::steady_clock::now() - slept));
+      POOL_STAT(counters::add(counters_for(index).wakes, 1));
+      --helpers;
+      --sleeping;
+    }
+  }
+
+  //Splits [start, end) according to policy and calls fn(job, b, e) on every
+  //piece, where job < size() is the same for every piece handed to one job
+  template <typename Iter, typename Fn>
+  void for_chunks(Iter start, Iter end, schedule policy, std::ptrdiff_t grain, Fn fn) {
+    //An elastic pool splits for the workers it has now, not the most it
+    //could have
+    const std::ptrdiff_t THREADS = elastic ? std::max(1, live.load()) : size();
+    const std::ptrdiff_t COUNT = end - start;
+    if (COUNT <= 0) return;
+    if (grain < 0) grain = 0;
+    auto chunk = [&fn, start](std::ptrdiff_t job, std::ptrdiff_t b, std::ptrdiff_t e) {
+      TRACE_SPAN("parallel_for chunk", "items", e - b);
+      fn(job, static_cast<Iter>(start + b), static_cast<Iter>(start + e));
+    };
+
+    if (policy == schedule::affinity || (policy == schedule::static_blocks && grain == 0)) {
+      //One block per thread, the remainder spread over the first blocks
+      const auto JOBS = COUNT < THREADS ? COUNT : THREADS;
+      const auto PER = COUNT / JOBS, ADDL = COUNT % JOBS;
+      run_chunks(JOBS, [&](std::ptrdiff_t i) {
+        auto b = i * PER + (i < ADDL ? i : ADDL);
+        chunk(i, b, b + PER + (i < ADDL ? 1 : 0));
+      }, policy == schedule::affinity);
+    } else if (policy == schedule::static_blocks) {
+      //grain-sized chunks dealt round robin, decided up front
+      const auto CHUNKS = (COUNT + grain - 1) / grain;
+      const auto JOBS = CHUNKS < THREADS ? CHUNKS : THREADS;
+      run_chunks(JOBS, [&](std::ptrdiff_t i) {
+        for (auto c = i; c < CHUNKS; c += JOBS) {
+          auto b = c * grain;
+          chunk(i, b, b + grain < COUNT ? b + grain : COUNT);
+        }
+      });
+    } else {
+      //Chunks are claimed off a shared counter as workers free up
+      if (grain == 0) grain = policy == schedule::dynamic ? COUNT / (THREADS * 8) : 1;
+      if (grain < 1) grain = 1;
+      const auto CHUNKS = (COUNT + grain - 1) / grain;
+      const auto JOBS = CHUNKS < THREADS ? CHUNKS : THREADS;
+      std::atomic<std::ptrdiff_t> next(0);
+      run_chunks(JOBS, [&](std::ptrdiff_t i) {
+        for (;;) {
+          std::ptrdiff_t b, n;
+          if (policy == schedule::dynamic) {
+            b = next.fetch_add(grain);
+            n = grain;
+          } else {
+            //guided: take a share of what's left, never less than grain
+            b = next.load();
+            do {
+              if (b >= COUNT) break;
+              n = (COUNT - b) / (2 * THREADS);
+              if (n < grain) n = grain;
+            } while (!next.compare_exchange_weak(b, b + n));
+          }
+          if (b >= COUNT) break;
+          chunk(i, b, b + n < COUNT ? b + n : COUNT);
+        }
+      });
     }
   }
 
 public:
-  Pool() : Pool(std::thread::hardware_concurrency() * 3) {}
+  //Elastic: one worker per hardware thread, growing to three per hardware
+  //thread when jobs back up or block
+  Pool() : Pool(elastic_defaults()) {}
 
-  Pool(const int& count) {
+  Pool(const int& count, pool_mode mode = pool_mode::shared) {
     this->count = count;
-    provision();
+    this->mode = mode;
+    this->pinned = false;
+    provision(count);
+  }
+
+  explicit Pool(const pool_options& options) {
+    const int threads = options.threads > 0 ? options.threads : cs477::topology::get().cores();
+    this->count = options.max_threads > threads ? options.max_threads : threads;
+    this->mode = options.mode;
+    this->pinned = options.pin;
+    this->aging = options.aging;
+    this->elastic = this->count > threads;
+    this->min_live = threads;
+    this->idle_timeout = options.idle_timeout;
+    this->grow_interval = options.grow_interval;
+    this->on_resize = options.on_resize;
+    provision(threads);
+  }
+
+  static pool_options elastic_defaults() {
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    if (hw < 1) hw = 1;
+    pool_options options;
+    options.threads = hw;
+    options.max_threads = hw * 3;
+    return options;
   }
 
+  //Drains whatever is still queued, unless shutdown() already ran
   ~Pool() {
+    shutdown();
+    //Clean up our atomic variable
+    delete stopping;
+  }
+
+  //Stops taking work from outside the pool, deals with what's queued per
+  //`how` and joins the workers. Jobs already running finish either way, as
+  //do parallel_for chunks and posted jobs, which someone may be waiting on.
+  //Must be called from outside the pool; later calls do nothing.
+  void shutdown(shutdown_mode how = shutdown_mode::drain) {
+    if (current().pool == this || current().running == this) throw std::logic_error("a pool can't shut itself down");
+    std::lock_guard<std::mutex> lock(lifecycle);
+    if (how == shutdown_mode::discard) discarding.store(true);
+    if (closed.exchange(true)) return;
+    help_until([this]() { return outstanding.load(std::memory_order_acquire) == 0; });
     //Signal shutdown to the workers
-    shutdown->store(true);
+    stopping->store(true);
     {
       std::unique_lock<std::mutex> lock(m2);
       cv.notify_all();
     }
+    //Let a grow() that got in before `stopping` finish starting its thread;
+    //none start after this
+    {
+      std::lock_guard<std::mutex> resizing(resize_m);
+    }
     //Wait for all workers to finish current work
-    for (auto i = threads.begin(); i != threads.end(); ++i) i->join();
-    //Clean up our atomic variable
-    delete shutdown;
+    for (auto i = threads.begin(); i != threads.end(); ++i) {
+      if (i->joinable()) i->join();
+    }
+  }
+
+  bool is_shutdown() const { return closed.load(); }
+
+  //Runs f, telling an elastic pool that the calling worker may block in it
+  //(I/O, sleeping, waiting on something outside the pool) so it can start
+  //another worker for the queued jobs in the meantime
+  template <typename F>
+  auto blocking(F&& f) -> decltype(f()) {
+    struct scope {
+      std::atomic<int>* blocked;
+      ~scope() {
+        if (blocked) --*blocked;
+      }
+    } s{nullptr};
+    if (elastic && worker_index() >= 0) {
+      s.blocked = &blocked;
+      ++blocked;
+      if (pending.load() > 0 && sleeping.load() == 0) grow(resize_reason::blocked);
+    }
+    return f();
   }
 
   template <typename Iter, typename Fn>
   void parallel_for(Iter start, Iter end, Fn fn) {
-    const int THREADS = size();
-    const int COUNT = end - start;
-    auto block_size = COUNT / size();
-    if (block_size < 1) block_size = 1;
-    std::vector<std::future<void>> futures;
-    futures.reserve(THREADS);
-    auto curr = start;
-    for (auto i = 0; i < THREADS && curr < end; ++i) {
-      auto next = curr + block_size;
-      if (next >= end) {
-        next = end;
-      }
-      futures.push_back(submit([curr, next, fn]() {
-        for (auto j = curr; j != next; ++j) fn(j);
-      }));
-      curr = next;
-    }
-    for (auto it = futures.begin(); it != futures.end(); ++it) it->wait();
+    parallel_for(start, end, std::move(fn), schedule::static_blocks);
+  }
+
+  //Calls fn(j) for every j in [start, end)
+  template <typename Iter, typename Fn>
+  void parallel_for(Iter start, Iter end, Fn fn, schedule policy, std::ptrdiff_t grain = 0) {
+    parallel_for_range(start, end, [&fn](Iter b, Iter e) {
+      for (auto j = b; j != e; ++j) fn(j);
+    }, policy, grain);
+  }
+
+  //Calls fn(b, e) on sub-ranges of [start, end) so the body can run its own
+  //(vectorizable) inner loop. `grain` is the smallest chunk handed out; 0
+  //picks one per policy.
+  template <typename Iter, typename Fn>
+  void parallel_for_range(Iter start, Iter end, Fn fn, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+    for_chunks(start, end, policy, grain, [&fn](std::ptrdiff_t, Iter b, Iter e) {
+      fn(b, e);
+    });
+  }
+
+  //parallel_for_range that stops handing out chunks once `token` fires, then
+  //throws cs477::operation_cancelled. Bodies that run long can poll the token
+  //themselves (or call token.throw_if_cancelled()).
+  template <typename Iter, typename Fn>
+  void parallel_for_range(Iter start, Iter end, Fn fn, const cs477::cancel_token& token, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+    std::atomic<bool> skipped(false);
+    for_chunks(start, end, policy, grain, [&](std::ptrdiff_t, Iter b, Iter e) {
+      if (skipped.load(std::memory_order_relaxed) || token.cancelled()) {
+        skipped.store(true, std::memory_order_relaxed);
+        return;
+      }
+      fn(b, e);
+    });
+    if (skipped.load()) throw cs477::operation_cancelled();
+  }
+
+  template <typename Iter, typename Fn>
+  void parallel_for(Iter start, Iter end, Fn fn, const cs477::cancel_token& token, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+    parallel_for_range(start, end, [&fn](Iter b, Iter e) {
+      for (auto j = b; j != e; ++j) fn(j);
+    }, token, policy, grain);
+  }
+
+  //Folds every chunk of [start, end) with map(b, e) and merges the partial
+  //results with combine. Each job keeps its own partial (on its own cache
+  //line), so nothing is shared until the final merge on the calling thread.
+  template <typename Iter, typename T, typename Map, typename Combine>
+  T parallel_reduce(Iter start, Iter end, T identity, Map map, Combine combine, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+    std::vector<padded<T>> partials(size(), padded<T>(identity));
+    for_chunks(start, end, policy, grain, [&](std::ptrdiff_t job, Iter b, Iter e) {
+      partials[job].value = combine(std::move(partials[job].value), map(b, e));
+    });
+    for (auto& p : partials) identity = combine(std::move(identity), std::move(p.value));
+    return identity;
+  }
+
+  //parallel_reduce where map is applied to each element: transform(j)
+  template <typename Iter, typename T, typename Transform, typename Combine>
+  T parallel_transform_reduce(Iter start, Iter end, T identity, Transform transform, Combine combine, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+    return parallel_reduce(start, end, identity, [&](Iter b, Iter e) {
+      auto t = identity;
+      for (auto j = b; j != e; ++j) t = combine(std::move(t), transform(j));
+      return t;
+    }, combine, policy, grain);
+  }
+
+  //Waits for f by running other jobs in the meantime; safe to call from
+  //inside a job
+  template <typename T>
+  void wait(const cs477::future<T>& f) {
+    help_until([&f]() { return f.is_ready(); });
+  }
+
+  template <typename T>
+  T get(cs477::future<T>& f) {
+    wait(f);
+    return f.get();
+  }
+
+  //Fork-join: b is queued, a runs on the calling thread, and we help out
+  //until b is done. Exceptions from either are rethrown (a's first).
+  template <typename A, typename B>
+  void invoke(A&& a, B&& b) {
+    admit(1);
+    latch done(1);
+    push([&b, &done]() {
+      try {
+        b();
+        done.count_down();
+      } catch (...) {
+        done.count_down(std::current_exception());
+      }
+    });
+    std::exception_ptr error;
+    try {
+      a();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    help_until([&done]() { return done.ready(); });
+    if (error) std::rethrow_exception(error);
+    done.rethrow();
   }
 
+  //Value-initializes [ptr, ptr + count) with schedule::affinity. Freshly
+  //allocated pages land on the NUMA node of the thread that first writes
+  //them, so later schedule::affinity loops over the same range (same length)
+  //find each block's memory on their own node.
+  template <typename T>
+  void first_touch(T* ptr, std::ptrdiff_t count) {
+    parallel_for_range(ptr, ptr + count, [](T* b, T* e) {
+      std::fill(b, e, T());
+    }, schedule::affinity);
+  }
+
+  bool is_pinned() const { return this->pinned; }
+
+  //Whether worker `index` runs on the CPU it was given; false when the pool
+  //isn't pinned or the OS refused (see worker_node)
+  bool worker_pinned(int index) const { return workers[index]->cpu >= 0 && !workers[index]->unpinned.load(); }
+
+  //NUMA node worker `index` is pinned to, or -1 when the pool isn't pinned
+  //or pinning that worker failed
+  int worker_node(int index) const { return workers[index]->unpinned.load() ? -1 : workers[index]->node; }
+
+  //Index of the calling thread within this pool, or -1 if it isn't one of ours
+  int worker_index() const {
+    auto& ctx = current();
+    return ctx.pool == this ? ctx.index : -1;
+  }
+
+  //Worker slots: the thread count of a fixed pool, the most an elastic one
+  //will start
   int size() const { return this->count; }
 
+  //Worker threads running right now
+  int thread_count() const { return live.load(); }
+
+  bool is_elastic() const { return this->elastic; }
+
+  pool_mode scheduling() const { return this->mode; }
+
+  //The callable and its result share a single allocation; the queued job
+  //just carries a reference to it
   template <typename F>
-  auto submit(F&& f) -> std::future<decltype(f())> {
-    auto p = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
-    m.lock();
-    auto l = [p]() {
-      (*p)();
-    };
-    jobs.emplace_back(std::async(std::launch::deferred, std::move(l)));
-    m.unlock();
-    std::unique_lock<std::mutex> lock(m2);
-    cv.notify_one();
-    return p->get_future();
+  auto submit(F&& f) -> cs477::future<std::result_of_t<std::decay_t<F>&()>> {
+    return submit(priority::normal, std::forward<F>(f));
+  }
+
+  template <typename F>
+  auto submit(priority p, F&& f) -> cs477::future<std::result_of_t<std::decay_t<F>&()>> {
+    return submit(cs477::cancel_token(), p, std::forward<F>(f));
+  }
+
+  //If `token` has fired by the time the job is dequeued (see
+  //cancel_token::after for deadlines), it is dropped without running and the
+  //future throws cs477::operation_cancelled. Throws if the pool is shut down.
+  template <typename F>
+  auto submit(const cs477::cancel_token& token, F&& f) -> cs477::future<std::result_of_t<std::decay_t<F>&()>> {
+    return submit(token, priority::normal, std::forward<F>(f));
+  }
+
+  template <typename F>
+  auto submit(const cs477::cancel_token& token, priority p, F&& f) -> cs477::future<std::result_of_t<std::decay_t<F>&()>> {
+    using R = std::result_of_t<std::decay_t<F>&()>;
+    using S = cs477::details::task_state<R, std::decay_t<F>>;
+    admit(1);
+    cs477::details::ref<cs477::details::state<R>> s(new S(std::forward<F>(f)));
+    cs477::details::ref<S> t(static_cast<S*>(s.get()));
+    s->addref();
+    push(guarded<S>{cs477::details::run_task<S>(std::move(t)), token, &discarding}, p);
+    return cs477::future<R>(std::move(s));
+  }
+
+  //Queues f without a future, for callers that track completion themselves.
+  //Always runs, even when shutting down with shutdown_mode::discard.
+  template <typename F>
+  void post(F&& f, priority p = priority::normal) {
+    admit(1);
+    push(cs477::job(std::forward<F>(f)), p);
+  }
+
+  //Snapshot of every counter. Per-worker counters need POOL_STATS; lane
+  //depths and waits are always tracked.
+  pool_stats stats() {
+    pool_stats s;
+    for (auto& w : workers) s.workers.push_back(w->stats.snapshot());
+    s.outside = outside.snapshot();
+    for (int i = 0; i < 3; ++i) s.lanes[i] = queue_stats(static_cast<priority>(i));
+    s.pending = pending.load();
+    return s;
+  }
+
+  //Depth and queueing delay of one priority lane
+  lane_stats queue_stats(priority p) {
+    auto& l = lanes[static_cast<int>(p)];
+    std::lock_guard<std::mutex> lock(m);
+    using ms = std::chrono::duration<double, std::milli>;
+    return lane_stats{static_cast<int>(l.jobs.size()), l.dequeued, l.dequeued ? ms(l.waited).count() / l.dequeued : 0.0, ms(l.max_wait).count()};
   }
 
   template <typename F, typename... A>
-  auto submit(F&& f, A&&... a) -> std::future<decltype(f(a...))> {
-    auto p = std::make_shared<std::packaged_task<decltype(f(a...))()>>(std::bind(std::forward<F>(f), std::forward<A>(a)...));
-    m.lock();
-    auto l = [p]() {
-      (*p)();
-    };
-    jobs.emplace_back(std::async(std::launch::deferred, std::move(l)));
-    m.unlock();
-    std::unique_lock<std::mutex> lock(m2);
-    cv.notify_one();
-    return p->get_future();
+  auto submit(F&& f, A&&... a) -> cs477::future<decltype(f(a...))> {
+    return submit(std::bind(std::forward<F>(f), std::forward<A>(a)...));
   }
 };
 
+//One T per pool worker (plus one per outside thread that asks for it), for
+//accumulators like histograms that every thread fills on its own and that
+//are merged once the parallel work is done. `init` should be the identity
+//of whatever the values get combined with.
+template <typename T>
+class combinable {
+private:
+  struct slot {
+    explicit slot(const T& value) : value(value) {}
+    T value;
+    char pad[64];
+  };
+
+  Pool& pool;
+  T init;
+  std::vector<slot> slots;
+  //Threads that aren't workers of the pool (rare, so a lock is fine)
+  std::mutex m;
+  std::deque<std::pair<std::thread::id, T>> others;
+
+public:
+  combinable(Pool& pool, const T& init = T()) : pool(pool), init(init), slots(pool.size(), slot(init)) {}
+
+  combinable(const combinable&) = delete;
+  combinable& operator=(const combinable&) = delete;
+
+  //The calling thread's value
+  T& local() {
+    auto i = pool.worker_index();
+    if (i >= 0) return slots[i].value;
+    auto id = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(m);
+    for (auto& o : others) {
+      if (o.first == id) return o.second;
+    }
+    others.emplace_back(id, init);
+    return others.back().second;
+  }
+
+  template <typename Combine>
+  T combine(Combine fn) {
+    T result = init;
+    combine_each([&](const T& t) { result = fn(std::move(result), t); });
+    return result;
+  }
+
+  template <typename Fn>
+  void combine_each(Fn fn) {
+    for (auto& s : slots) fn(const_cast<const T&>(s.value));
+    std::lock_guard<std::mutex> lock(m);
+    for (auto& o : others) fn(const_cast<const T&>(o.second));
+  }
+};
+
+namespace details {
+inline std::atomic<int>& default_pool_threads() {
+  static std::atomic<int> count(0);
+  return count;
+}
+
+inline std::atomic<bool>& default_pool_started() {
+  static std::atomic<bool> started(false);
+  return started;
+}
+}
+
+//Sets the thread count of the default pool. Only works before the pool's
+//first use (returns false afterwards); 0 means one thread per core.
+inline bool set_default_pool_size(int count) {
+  if (details::default_pool_started().load()) return false;
+  details::default_pool_threads().store(count);
+  return true;
+}
+
+//The process-wide pool behind the free parallel_for & friends. It is
+//created on first use and joined when the process exits; since waits inside
+//it help out instead of blocking, nested parallel_for calls are fine.
+inline Pool& default_pool() {
+  static Pool pool([]() {
+    details::default_pool_started().store(true);
+    int count = details::default_pool_threads().load();
+    if (count < 1) count = std::thread::hardware_concurrency();
+    return count < 1 ? 1 : count;
+  }(), pool_mode::work_stealing);
+  return pool;
+}
+
 template <typename Iter, typename Fn>
 void parallel_for(Iter start, Iter end, Fn fn) {
-  Pool p;
-  p.parallel_for(start, end, fn);
+  default_pool().parallel_for(start, end, fn);
+}
+
+template <typename Iter, typename Fn>
+void parallel_for(Iter start, Iter end, Fn fn, schedule policy, std::ptrdiff_t grain = 0) {
+  default_pool().parallel_for(start, end, fn, policy, grain);
+}
+
+template <typename Iter, typename Fn>
+void parallel_for_range(Iter start, Iter end, Fn fn, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+  default_pool().parallel_for_range(start, end, fn, policy, grain);
+}
+
+template <typename Iter, typename T, typename Map, typename Combine>
+T parallel_reduce(Iter start, Iter end, T identity, Map map, Combine combine, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+  return default_pool().parallel_reduce(start, end, identity, map, combine, policy, grain);
+}
+
+template <typename Iter, typename T, typename Transform, typename Combine>
+T parallel_transform_reduce(Iter start, Iter end, T identity, Transform transform, Combine combine, schedule policy = schedule::static_blocks, std::ptrdiff_t grain = 0) {
+  return default_pool().parallel_transform_reduce(start, end, identity, transform, combine, policy, grain);
 }
 
 template <typename Fn>
@@ -143,4 +1211,6 @@ std::future<std::result_of_t<Fn()>> queue_work(Fn fn) {
   return std::async(std::launch::async, std::move(fn));
 }
 
+#undef POOL_STAT
+
 #endif
@@ -15,30 +15,11 @@ auto then(std::shared_future<T> fut, F &&f) -> std::future<decltype(f(fut))> {
   return p->get_future();
 }
 
+// Kept for old callers; body returns a cs477::future<bool> now, and the
+// loop no longer needs a thread (or a stack frame) per iteration
 template <class Body>
-void task_loop(std::shared_ptr<std::promise<void>> p, Body body) {
-  auto s = body().share();
-  then(s, [=](auto f) {
-    try {
-      if (f.get())
-        task_loop(p, body);
-      else
-        p->set_value();
-    } catch (...) {
-    }
-  });
-}
-
-template <class Body>
-std::future<void> do_while(Body body) {
-  auto p = std::make_shared<std::promise<void>>();
-  std::async(std::launch::async, [=]() {
-    try {
-      task_loop(p, body);
-    } catch (...) {
-    }
-  });
-  return p->get_future();
+cs477::future<void> do_while(Body body) {
+  return cs477::do_while(std::move(body));
 }
 };
 
@@ -1,9 +1,20 @@
 #ifndef CON_QUEUE_HPP
 #define CON_QUEUE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <list>
+#include <memory>
 #include <mutex>
-#include <condition_variable>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "wait.hpp"
 
 template <typename T>
 class concurrent_queue {
@@ -42,4 +53,388 @@ public:
   }
 };
 
+namespace cs477 {
+
+// A bounded multi-producer/multi-consumer queue on a fixed ring of cells
+// (Vyukov's design). Each cell carries a sequence number saying whether it's
+// a producer's or a consumer's turn, so pushes and pops never lock and never
+// allocate; producers only contend with each other on `tail`, consumers on
+// `head`. Capacity is rounded up to a power of two.
+//
+// The try_ calls never block. push()/pop() spin briefly and then sleep on a
+// futex (WaitOnAddress on Windows); a push or pop only pays for a wakeup when
+// somebody is actually asleep. close() fails further pushes and lets
+// consumers drain what's left; a push racing close() may still land, so stop
+// the producers first if every item must be seen.
+template <typename T>
+class mpmc_queue {
+public:
+  static_assert(std::is_nothrow_move_constructible<T>::value, "mpmc_queue moves items into and out of its cells");
+
+  explicit mpmc_queue(size_t capacity) : mask(round_up(capacity) - 1), cells(new cell[mask + 1]) {
+    for (size_t i = 0; i <= mask; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  mpmc_queue(const mpmc_queue &) = delete;
+  mpmc_queue &operator=(const mpmc_queue &) = delete;
+
+  ~mpmc_queue() {
+    for (auto pos = head.pos.load(std::memory_order_relaxed); pos != tail.pos.load(std::memory_order_relaxed); ++pos) {
+      auto &c = cells[pos & mask];
+      if (c.seq.load(std::memory_order_relaxed) == pos + 1) c.value()->~T();
+    }
+  }
+
+  size_t capacity() const {
+    return mask + 1;
+  }
+
+  // A snapshot; may be stale by the time you look at it
+  size_t size() const {
+    auto t = tail.pos.load(std::memory_order_relaxed);
+    auto h = head.pos.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+
+  bool is_closed() const {
+    return closed.load(std::memory_order_acquire);
+  }
+
+  // False if the queue is full or closed; v is left alone then
+  bool try_push(T &&v) {
+    if (closed.load(std::memory_order_relaxed)) return false;
+    size_t pos;
+    if (!claim(tail, 0, 1, pos)) return false;
+    publish(pos, v);
+    consumers.notify_one();
+    return true;
+  }
+
+  bool try_push(const T &v) {
+    T copy(v);
+    return try_push(std::move(copy));
+  }
+
+  bool try_pop(T &out) {
+    size_t pos;
+    if (!claim(head, 1, 1, pos)) return false;
+    out = consume(pos);
+    producers.notify_one();
+    return true;
+  }
+
+  // Pushes as many of the n items at `first` as fit right now, claiming
+  // their cells in one go; returns how many went in
+  template <typename It>
+  size_t try_push_n(It first, size_t n) {
+    if (n == 0 || closed.load(std::memory_order_relaxed)) return 0;
+    size_t pos;
+    auto k = claim(tail, 0, n, pos);
+    for (size_t i = 0; i < k; ++i, ++first) publish(pos + i, *first);
+    if (k) notify(consumers, k);
+    return k;
+  }
+
+  // Pops up to max items into `out` without waiting; returns how many
+  template <typename OutIt>
+  size_t try_pop_n(OutIt out, size_t max) {
+    if (max == 0) return 0;
+    size_t pos;
+    auto k = claim(head, 1, max, pos);
+    for (size_t i = 0; i < k; ++i, ++out) *out = consume(pos + i);
+    if (k) notify(producers, k);
+    return k;
+  }
+
+  // Waits for room; false if the queue was closed first
+  bool push(T v) {
+    for (;;) {
+      if (try_push(std::move(v))) return true;
+      if (is_closed()) return false;
+      producers.wait_until([this]() { return ready(tail, 0) || is_closed(); });
+    }
+  }
+
+  // Waits for an item; false once the queue is closed and empty
+  bool pop(T &out) {
+    for (;;) {
+      if (try_pop(out)) return true;
+      if (is_closed()) return try_pop(out);
+      consumers.wait_until([this]() { return ready(head, 1) || is_closed(); });
+    }
+  }
+
+  // Pushes all n items, waiting for room as needed; returns how many went in
+  // (fewer than n only if the queue was closed)
+  template <typename It>
+  size_t push_n(It first, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+      auto k = try_push_n(first, n - done);
+      std::advance(first, k);
+      done += k;
+      if (done == n || is_closed()) break;
+      if (!k) producers.wait_until([this]() { return ready(tail, 0) || is_closed(); });
+    }
+    return done;
+  }
+
+  // Waits for at least one item, then takes up to max; returns how many (0
+  // once the queue is closed and empty)
+  template <typename OutIt>
+  size_t pop_n(OutIt out, size_t max) {
+    for (;;) {
+      if (auto k = try_pop_n(out, max)) return k;
+      if (is_closed()) return try_pop_n(out, max);
+      consumers.wait_until([this]() { return ready(head, 1) || is_closed(); });
+    }
+  }
+
+  // Fails pushes from now on and wakes everybody up
+  void close() {
+    closed.store(true, std::memory_order_release);
+    consumers.notify_all();
+    producers.notify_all();
+  }
+
+private:
+  struct cell {
+    // pos: free for the producer of pos; pos + 1: holds pos's item
+    std::atomic<size_t> seq;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+
+    T *value() {
+      return reinterpret_cast<T *>(&storage);
+    }
+  };
+
+  // A position counter on its own cache line
+  struct cursor {
+    char pad[64];
+    std::atomic<size_t> pos{0};
+  };
+
+  static size_t round_up(size_t n) {
+    size_t c = 2;
+    while (c < n) c <<= 1;
+    return c;
+  }
+
+  // Whether the cell at c's position is ready for its side: `lag` is 0 for
+  // producers, 1 for consumers
+  bool ready(const cursor &c, size_t lag) const {
+    auto pos = c.pos.load(std::memory_order_acquire);
+    return cells[pos & mask].seq.load(std::memory_order_acquire) == pos + lag;
+  }
+
+  // Claims up to n consecutive ready cells at c; returns how many, 0 if
+  // there are none (queue full for producers, empty for consumers)
+  size_t claim(cursor &c, size_t lag, size_t n, size_t &pos) {
+    pos = c.pos.load(std::memory_order_relaxed);
+    for (;;) {
+      auto seq = cells[pos & mask].seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + lag);
+      if (diff < 0) return 0;
+      if (diff > 0) {
+        // Somebody else took this one; start over from where they left off
+        pos = c.pos.load(std::memory_order_relaxed);
+        continue;
+      }
+      size_t k = 1;
+      while (k < n && cells[(pos + k) & mask].seq.load(std::memory_order_acquire) == pos + k + lag) ++k;
+      if (c.pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) return k;
+    }
+  }
+
+  template <typename U>
+  void publish(size_t pos, U &v) {
+    auto &c = cells[pos & mask];
+    new (&c.storage) T(std::move(v));
+    c.seq.store(pos + 1, std::memory_order_release);
+  }
+
+  static void notify(eventcount &e, size_t items) {
+    if (items > 1) {
+      e.notify_all();
+    } else {
+      e.notify_one();
+    }
+  }
+
+  T consume(size_t pos) {
+    auto &c = cells[pos & mask];
+    T v(std::move(*c.value()));
+    c.value()->~T();
+    c.seq.store(pos + mask + 1, std::memory_order_release);
+    return v;
+  }
+
+  // Read-mostly, then everything that gets written on a line of its own
+  const size_t mask;
+  std::unique_ptr<cell[]> cells;
+  std::atomic<bool> closed{false};
+  cursor tail;
+  cursor head;
+  // Sleeping pop()s, woken by pushes, and the other way round
+  eventcount consumers;
+  eventcount producers;
+};
+
+// A single-producer/single-consumer ring for connecting two pipeline stages.
+// Exactly one thread pushes and exactly one pops; in exchange every call is
+// wait-free and lock-free. Each side keeps its own index on its own cache
+// line plus a cached copy of the other side's, so it only reads the other
+// side's line when the ring looks full (or empty) to it.
+//
+// The producer can try_write() several items and flush() them in one go:
+// one release store and one wakeup check per batch. push()/pop() are the
+// optional blocking calls (spin, then sleep). close() is the producer saying
+// it's done; pop() returns false once everything before it has been taken.
+template <typename T>
+class spsc_channel {
+public:
+  static_assert(std::is_nothrow_move_constructible<T>::value, "spsc_channel moves items into and out of its slots");
+
+  explicit spsc_channel(size_t capacity) : mask(round_up(capacity) - 1), slots(new slot[mask + 1]) {}
+
+  spsc_channel(const spsc_channel &) = delete;
+  spsc_channel &operator=(const spsc_channel &) = delete;
+
+  ~spsc_channel() {
+    // Written-but-unflushed items count too
+    for (auto pos = out.head.load(std::memory_order_relaxed); pos != in.written; ++pos) value(pos)->~T();
+  }
+
+  size_t capacity() const {
+    return mask + 1;
+  }
+
+  // Producer: adds v without making it visible yet; false if the ring is full
+  bool try_write(T &&v) {
+    if (in.written - in.head_cache > mask) {
+      in.head_cache = out.head.load(std::memory_order_acquire);
+      if (in.written - in.head_cache > mask) return false;
+    }
+    new (value(in.written)) T(std::move(v));
+    ++in.written;
+    return true;
+  }
+
+  // Producer: publishes everything written so far
+  void flush() {
+    if (in.tail.load(std::memory_order_relaxed) == in.written) return;
+    in.tail.store(in.written, std::memory_order_release);
+    consumer.notify_one();
+  }
+
+  bool try_push(T &&v) {
+    if (!try_write(std::move(v))) return false;
+    flush();
+    return true;
+  }
+
+  // Producer: waits for room; false if the channel was closed
+  bool push(T v) {
+    for (;;) {
+      if (try_push(std::move(v))) return true;
+      // Whatever's written has to be visible, or the consumer may never
+      // make room
+      flush();
+      if (closed.load(std::memory_order_acquire)) return false;
+      producer.wait_until([this]() { return in.written - out.head.load(std::memory_order_acquire) <= mask || closed.load(std::memory_order_acquire); });
+    }
+  }
+
+  // Consumer
+  bool try_pop(T &v) {
+    auto pos = out.head.load(std::memory_order_relaxed);
+    if (pos == out.tail_cache) {
+      out.tail_cache = in.tail.load(std::memory_order_acquire);
+      if (pos == out.tail_cache) return false;
+    }
+    v = take(pos);
+    out.head.store(pos + 1, std::memory_order_release);
+    producer.notify_one();
+    return true;
+  }
+
+  // Consumer: takes up to max published items with one index update
+  template <typename OutIt>
+  size_t try_pop_n(OutIt dest, size_t max) {
+    auto pos = out.head.load(std::memory_order_relaxed);
+    if (out.tail_cache - pos < max) out.tail_cache = in.tail.load(std::memory_order_acquire);
+    auto n = std::min(max, static_cast<size_t>(out.tail_cache - pos));
+    for (size_t i = 0; i < n; ++i, ++dest) *dest = take(pos + i);
+    if (n) {
+      out.head.store(pos + n, std::memory_order_release);
+      producer.notify_one();
+    }
+    return n;
+  }
+
+  // Consumer: waits for an item; false once the channel is closed and empty
+  bool pop(T &v) {
+    for (;;) {
+      if (try_pop(v)) return true;
+      if (closed.load(std::memory_order_acquire)) return try_pop(v);
+      consumer.wait_until([this]() { return in.tail.load(std::memory_order_acquire) != out.head.load(std::memory_order_relaxed) || closed.load(std::memory_order_acquire); });
+    }
+  }
+
+  // Producer: publishes what's written and says nothing more is coming
+  void close() {
+    flush();
+    closed.store(true, std::memory_order_release);
+    consumer.notify_all();
+    producer.notify_all();
+  }
+
+  bool is_closed() const {
+    return closed.load(std::memory_order_acquire);
+  }
+
+private:
+  typedef std::aligned_storage_t<sizeof(T), alignof(T)> slot;
+
+  // The producer's line: what it has published, what it has written, and
+  // where it last saw the consumer
+  struct producer_side {
+    char pad[64];
+    std::atomic<size_t> tail{0};
+    size_t written = 0;
+    size_t head_cache = 0;
+  };
+
+  struct consumer_side {
+    char pad[64];
+    std::atomic<size_t> head{0};
+    size_t tail_cache = 0;
+  };
+
+  static size_t round_up(size_t n) {
+    size_t c = 2;
+    while (c < n) c <<= 1;
+    return c;
+  }
+
+  T *value(size_t pos) {
+    return reinterpret_cast<T *>(&slots[pos & mask]);
+  }
+
+  T take(size_t pos) {
+    T v(std::move(*value(pos)));
+    value(pos)->~T();
+    return v;
+  }
+
+  const size_t mask;
+  std::unique_ptr<slot[]> slots;
+  std::atomic<bool> closed{false};
+  producer_side in;
+  consumer_side out;
+  eventcount consumer;
+  eventcount producer;
+};
+}
+
 #endif
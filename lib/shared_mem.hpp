@@ -13,7 +13,7 @@
 #include <algorithm>
 #include <future>
 #include <atomic>
-#include "promise-polyfill.hpp"
+#include "future.hpp"
 
 namespace cs477 {
 
@@ -55,23 +55,30 @@ public:
     ReleaseSemaphore(sem, 1, nullptr);
   }
 
-  std::future<void> wait_async() {
+  // Acquires the semaphore without blocking a thread; continuations run on
+  // the thread pool thread that saw it signalled
+  cs477::future<void> wait_async() {
     struct wait_param {
-      std::promise<void> p;
+      cs477::promise<void> p;
     } *param = new wait_param;
     auto f = param->p.get_future();
 
     auto wait = CreateThreadpoolWait([](PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT wait, TP_WAIT_RESULT result) {
       auto param = (wait_param *) context;
+      CloseThreadpoolWait(wait);
 
       if (result == WAIT_OBJECT_0) {
         param->p.set_value();
       } else {
-        auto err = std::error_code{(int) result, std::system_category()};
-        param->p.set_exception(std::make_exception_ptr(err));
+        param->p.set_exception(std::make_exception_ptr(std::system_error((int) result, std::system_category())));
       }
-
+      delete param;
     }, param, nullptr);
+    if (!wait) {
+      param->p.set_exception(std::make_exception_ptr(std::system_error(GetLastError(), std::system_category())));
+      delete param;
+      return f;
+    }
 
     SetThreadpoolWait(wait, sem, nullptr);
 
@@ -266,12 +273,10 @@ public:
     _full.release();
   }
 
-  std::future<void> write_async(T value) {
-    std::future<void> f = _empty.wait_async();
-    f = f.then([this, value](auto f) mutable {
+  cs477::future<void> write_async(T value) {
+    return _empty.wait_async().then([this, value](cs477::future<void> f) {
       f.get();
-      f = _lock.wait_async();
-      f = f.then([this, value](auto f) {
+      return _lock.wait_async().then([this, value](cs477::future<void> f) {
         f.get();
 
         _vector[*_write] = value;
@@ -281,10 +286,7 @@ public:
         _lock.release();
         _full.release();
       });
-      return f;
     });
-
-    return f;
   }
 
   T read() {
@@ -301,11 +303,10 @@ public:
     return t;
   }
 
-  std::future<T> read_async() {
-    std::future<T> f = _full.wait_async().then([this](auto f) mutable {
+  cs477::future<T> read_async() {
+    return _full.wait_async().then([this](cs477::future<void> f) {
       f.get();
-      f = _lock.wait_async();
-      return f.then([this](auto f) {
+      return _lock.wait_async().then([this](cs477::future<void> f) {
         f.get();
 
         auto t = _vector[*_read];
@@ -318,8 +319,6 @@ public:
         return t;
       });
     });
-
-    return f;
   }
 
 private:
@@ -0,0 +1,294 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+// C++20 coroutines on top of cs477::future. Everything here needs a compiler
+// with coroutine support (/std:c++latest, -std=c++20); without it the header
+// is empty and CS477_HAS_COROUTINES stays undefined, so callers can keep a
+// then() version alongside.
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "future.hpp"
+
+#define CS477_HAS_COROUTINES 1
+
+namespace cs477 {
+
+template <typename T = void>
+class task;
+
+namespace details {
+
+class task_promise_base {
+public:
+  // Lazy: nothing runs until the task is awaited or spawned
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+
+  // Jumps straight back into whoever awaited us (symmetric transfer, so long
+  // chains of tasks finishing synchronously don't grow the stack). A spawned
+  // task has nobody to go back to and frees itself.
+  struct final_awaiter {
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      auto &p = h.promise();
+      if (p.continuation) return p.continuation;
+      if (p.detached) h.destroy();
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  final_awaiter final_suspend() noexcept {
+    return {};
+  }
+
+  void unhandled_exception() {
+    error = std::current_exception();
+  }
+
+  std::coroutine_handle<> continuation;
+  bool detached = false;
+
+protected:
+  void rethrow() {
+    if (error) std::rethrow_exception(error);
+  }
+
+private:
+  std::exception_ptr error;
+};
+
+template <typename T>
+class task_promise : public task_promise_base {
+public:
+  task<T> get_return_object() noexcept;
+
+  template <typename U>
+  void return_value(U &&v) {
+    value.emplace(std::forward<U>(v));
+  }
+
+  T result() {
+    rethrow();
+    return std::move(*value);
+  }
+
+private:
+  std::optional<T> value;
+};
+
+template <>
+class task_promise<void> : public task_promise_base {
+public:
+  task<void> get_return_object() noexcept;
+
+  void return_void() {}
+
+  void result() {
+    rethrow();
+  }
+};
+}
+
+// A coroutine returning T. The whole coroutine (its locals included) lives in
+// the one frame the compiler allocates when it is called, so a request handler
+// written as a task costs one allocation however many times it suspends.
+//
+// Tasks start when awaited, or when handed to spawn()/start(). Awaiting one
+// resumes the awaiting coroutine right where the task finished; exceptions
+// come out of co_await.
+template <typename T>
+class task {
+public:
+  typedef details::task_promise<T> promise_type;
+
+  task() noexcept {}
+  explicit task(std::coroutine_handle<promise_type> h) noexcept : h(h) {}
+
+  task(task &&x) noexcept : h(std::exchange(x.h, nullptr)) {}
+  task &operator=(task &&x) noexcept {
+    if (this != &x) {
+      if (h) h.destroy();
+      h = std::exchange(x.h, nullptr);
+    }
+    return *this;
+  }
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+
+  ~task() {
+    if (h) h.destroy();
+  }
+
+  bool valid() const noexcept {
+    return static_cast<bool>(h);
+  }
+
+  auto operator co_await() &&noexcept {
+    struct awaiter {
+      std::coroutine_handle<promise_type> h;
+
+      bool await_ready() noexcept {
+        return !h || h.done();
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h.promise().continuation = awaiting;
+        return h;
+      }
+
+      T await_resume() {
+        if (!h) throw std::future_error(std::future_errc::no_state);
+        return h.promise().result();
+      }
+    };
+    return awaiter{h};
+  }
+
+  // Gives up the frame; whoever takes it must destroy it
+  std::coroutine_handle<promise_type> release() noexcept {
+    return std::exchange(h, nullptr);
+  }
+
+private:
+  std::coroutine_handle<promise_type> h;
+};
+
+namespace details {
+template <typename T>
+task<T> task_promise<T>::get_return_object() noexcept {
+  return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+  return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// co_await on a future: suspends until it's ready and resumes on the thread
+// that finished it (an I/O completion thread, say)
+template <typename T>
+struct future_awaiter {
+  future<T> f;
+
+  bool await_ready() {
+    return f.is_ready();
+  }
+
+  // If the future got there while we were registering, just carry on
+  bool await_suspend(std::coroutine_handle<> h) {
+    return f.when_ready([h]() { h.resume(); });
+  }
+
+  T await_resume() {
+    return f.get();
+  }
+};
+
+template <typename Executor>
+struct resume_awaiter {
+  Executor &ex;
+
+  bool await_ready() noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    ex.post([h]() { h.resume(); });
+  }
+
+  void await_resume() noexcept {}
+};
+}
+
+// Lets a coroutine co_await anything that hands back a cs477::future:
+// socket::recv_async(), send_async(), read_file_async(),
+// semaphore::wait_async() and the rest
+template <typename T>
+details::future_awaiter<T> operator co_await(future<T> &&f) {
+  return details::future_awaiter<T>{std::move(f)};
+}
+
+// `co_await resume_on(pool)` moves the rest of the coroutine onto ex (a Pool,
+// or anything else with post()), e.g. to get CPU-heavy work off an I/O thread.
+// If post() throws, so does the co_await.
+template <typename Executor>
+details::resume_awaiter<Executor> resume_on(Executor &ex) {
+  return details::resume_awaiter<Executor>{ex};
+}
+
+// Starts t and lets it run to completion on its own; the frame frees itself
+// when the coroutine ends. An exception that escapes t is dropped, so a task
+// run this way should handle its own errors.
+inline void spawn(task<void> t) {
+  auto h = t.release();
+  if (!h) return;
+  h.promise().detached = true;
+  h.resume();
+}
+
+namespace details {
+// A coroutine nobody waits on: runs eagerly, frees itself at the end
+struct fire_and_forget {
+  struct promise_type {
+    fire_and_forget get_return_object() noexcept {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+template <typename T>
+fire_and_forget settle(task<T> t, promise<T> p) {
+  try {
+    p.set_value(co_await std::move(t));
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+inline fire_and_forget settle(task<void> t, promise<void> p) {
+  try {
+    co_await std::move(t);
+    p.set_value();
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+}
+
+// Starts t and returns a future for its result, for callers that aren't
+// coroutines themselves. Costs a second frame and the future's state; use
+// spawn() when nobody needs the result.
+template <typename T>
+future<T> start(task<T> t) {
+  promise<T> p;
+  auto f = p.get_future();
+  details::settle(std::move(t), std::move(p));
+  return f;
+}
+}
+
+#endif
+
+#endif
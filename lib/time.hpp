@@ -7,7 +7,8 @@ inline std::chrono::time_point<std::chrono::high_resolution_clock> now() {
   return std::chrono::high_resolution_clock::now();
 }
 
-inline int to_seconds(std::chrono::time_point<std::chrono::high_resolution_clock> t1, std::chrono::time_point<std::chrono::high_resolution_clock> t2) {
+// Fractional: a run of 1.9 s used to come out as 1
+inline double to_seconds(std::chrono::time_point<std::chrono::high_resolution_clock> t1, std::chrono::time_point<std::chrono::high_resolution_clock> t2) {
   std::chrono::duration<double> diff = t2 - t1;
   return diff.count();
 }
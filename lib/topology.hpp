@@ -0,0 +1,219 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cs477 {
+
+// One logical CPU (a hardware thread).
+struct cpu_info {
+  int id;
+  // Physical core; SMT siblings share it
+  int core;
+  int package;
+  int node;
+};
+
+// The CPUs this process may run on (online ones, less whatever taskset or a
+// cgroup cpuset took away), with their cores and NUMA nodes. Falls back to
+// "every CPU is its own core on node 0" when the OS won't tell us.
+class topology {
+public:
+  std::vector<cpu_info> cpus;
+
+  int cores() const {
+    std::set<std::pair<int, int>> s;
+    for (auto &c : cpus) s.emplace(c.package, c.core);
+    return static_cast<int>(s.size());
+  }
+
+  int nodes() const {
+    std::set<int> s;
+    for (auto &c : cpus) s.insert(c.node);
+    return static_cast<int>(s.size());
+  }
+
+  // CPU ids in the order workers should be pinned: the first hardware thread
+  // of every core (taking the nodes in turn), then the SMT siblings.
+  std::vector<int> placement() const {
+    auto sorted = cpus;
+    std::sort(sorted.begin(), sorted.end(), [](const cpu_info &a, const cpu_info &b) { return a.id < b.id; });
+
+    struct slot {
+      int sibling, turn, node, id;
+    };
+    std::map<std::pair<int, int>, int> siblings;
+    std::map<std::pair<int, int>, int> turns;
+    std::vector<slot> slots;
+    for (auto &c : sorted) {
+      // which hardware thread of its core this is, and how many of those
+      // this node has handed out already
+      auto sibling = siblings[std::make_pair(c.package, c.core)]++;
+      auto turn = turns[std::make_pair(sibling, c.node)]++;
+      slots.push_back({sibling, turn, c.node, c.id});
+    }
+    std::stable_sort(slots.begin(), slots.end(), [](const slot &a, const slot &b) {
+      if (a.sibling != b.sibling) return a.sibling < b.sibling;
+      if (a.turn != b.turn) return a.turn < b.turn;
+      return a.node < b.node;
+    });
+
+    std::vector<int> ids;
+    for (auto &s : slots) ids.push_back(s.id);
+    return ids;
+  }
+
+  const cpu_info *find(int id) const {
+    for (auto &c : cpus) {
+      if (c.id == id) return &c;
+    }
+    return nullptr;
+  }
+
+  static topology detect();
+
+  // Detected once and cached
+  static const topology &get() {
+    static topology t = detect();
+    return t;
+  }
+
+private:
+  static topology fallback() {
+    topology t;
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    if (n < 1) n = 1;
+    for (int i = 0; i < n; ++i) t.cpus.push_back({i, i, 0, 0});
+    return t;
+  }
+
+#ifndef _WIN32
+  // Parses a sysfs CPU list like "0-3,8-11"
+  static std::vector<int> read_list(const std::string &path) {
+    std::vector<int> ids;
+    std::ifstream in(path);
+    std::string text;
+    if (!std::getline(in, text)) return ids;
+    size_t pos = 0;
+    while (pos < text.size()) {
+      auto comma = text.find(',', pos);
+      if (comma == std::string::npos) comma = text.size();
+      auto item = text.substr(pos, comma - pos);
+      auto dash = item.find('-');
+      try {
+        if (dash == std::string::npos) {
+          ids.push_back(std::stoi(item));
+        } else {
+          for (int i = std::stoi(item.substr(0, dash)), e = std::stoi(item.substr(dash + 1)); i <= e; ++i) ids.push_back(i);
+        }
+      } catch (...) {
+      }
+      pos = comma + 1;
+    }
+    return ids;
+  }
+
+  static int read_int(const std::string &path, int otherwise) {
+    std::ifstream in(path);
+    int v;
+    return in >> v ? v : otherwise;
+  }
+#endif
+};
+
+#ifdef _WIN32
+inline topology topology::detect() {
+  DWORD len = 0;
+  GetLogicalProcessorInformation(nullptr, &len);
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (info.empty() || !GetLogicalProcessorInformation(info.data(), &len)) return fallback();
+
+  const int BITS = sizeof(ULONG_PTR) * 8;
+  std::vector<cpu_info> cpus(BITS, cpu_info{-1, 0, 0, 0});
+  int core = 0, package = 0;
+  for (auto &i : info) {
+    for (int b = 0; b < BITS; ++b) {
+      if (!(i.ProcessorMask & (ULONG_PTR(1) << b))) continue;
+      cpus[b].id = b;
+      if (i.Relationship == RelationProcessorCore) cpus[b].core = core;
+      if (i.Relationship == RelationProcessorPackage) cpus[b].package = package;
+      if (i.Relationship == RelationNumaNode) cpus[b].node = static_cast<int>(i.NumaNode.NodeNumber);
+    }
+    if (i.Relationship == RelationProcessorCore) core++;
+    if (i.Relationship == RelationProcessorPackage) package++;
+  }
+
+  DWORD_PTR allowed = 0, system = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &allowed, &system)) allowed = ~DWORD_PTR(0);
+  topology t;
+  for (auto &c : cpus) {
+    if (c.id >= 0 && (allowed & (DWORD_PTR(1) << c.id))) t.cpus.push_back(c);
+  }
+  return t.cpus.empty() ? fallback() : t;
+}
+
+// Pins the calling thread to one CPU; false if the OS refused
+inline bool pin_current_thread(int cpu) {
+  if (cpu < 0 || cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8)) return false;
+  return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+}
+#else
+inline topology topology::detect() {
+  const std::string ROOT = "/sys/devices/system/cpu/";
+  auto online = read_list(ROOT + "online");
+  if (online.empty()) return fallback();
+
+  // Pinning a worker outside the affinity mask fails, so leave those out
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    online.erase(std::remove_if(online.begin(), online.end(), [&](int id) {
+      return id < 0 || id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed);
+    }), online.end());
+    if (online.empty()) return fallback();
+  }
+
+  topology t;
+  for (auto id : online) {
+    auto dir = ROOT + "cpu" + std::to_string(id) + "/topology/";
+    t.cpus.push_back({id, read_int(dir + "core_id", id), read_int(dir + "physical_package_id", 0), 0});
+  }
+  for (auto node : read_list("/sys/devices/system/node/online")) {
+    for (auto id : read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")) {
+      for (auto &c : t.cpus) {
+        if (c.id == id) c.node = node;
+      }
+    }
+  }
+  return t;
+}
+
+// Pins the calling thread to one CPU; false if the OS refused
+inline bool pin_current_thread(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#endif
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define CS477_TRACE_TSC 1
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define CS477_TRACE_TSC 1
+#endif
+
+// Build with TRACING defined to true to record trace spans (see
+// cs477::trace::save). Without it the TRACE_* macros expand to nothing, so
+// the instrumented code is exactly what it was before.
+#ifndef TRACING
+#define TRACING false
+#endif
+
+// Events each thread keeps; older ones are overwritten (a power of two)
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 32768
+#endif
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+
+#if TRACING
+#define TRACE_ONLY(...) __VA_ARGS__
+// Times the rest of the enclosing scope: TRACE_SPAN("conv") or
+// TRACE_SPAN("recv", "bytes", n). Names must be string literals.
+#define TRACE_SPAN(...) cs477::trace::span TRACE_CAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_ONLY(...)
+#define TRACE_SPAN(...)
+#endif
+
+namespace cs477 {
+namespace trace {
+
+// The clock spans are stamped with: the time stamp counter where there is one
+// (a few cycles to read, and constant-rate on anything recent), steady_clock
+// nanoseconds elsewhere. Ticks become microseconds when the trace is saved.
+inline uint64_t ticks() {
+#if defined(CS477_TRACE_TSC)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// A span argument that is a length of time (in ticks), shown in microseconds
+struct elapsed {
+  uint64_t ticks;
+};
+
+// Time from `start` (from ticks()) until now
+inline elapsed since(uint64_t start) {
+  return elapsed{ticks() - start};
+}
+
+namespace details {
+
+struct event {
+  std::atomic<const char *> name{nullptr}, arg_name{nullptr};
+  std::atomic<uint64_t> start{0}, end{0};
+  std::atomic<int64_t> arg{0};
+  std::atomic<bool> arg_elapsed{false};
+};
+
+// What the exporter copies out of a ring
+struct record {
+  const char *name, *arg_name;
+  uint64_t start, end;
+  int64_t arg;
+  bool arg_elapsed;
+};
+
+// One thread's events. Only the owning thread writes, so recording is a few
+// plain stores and no locks; the exporter can read at any time and drops
+// whatever was overwritten while it was copying.
+struct ring {
+  static const uint64_t SIZE = TRACE_BUFFER_EVENTS;
+  static_assert((SIZE & (SIZE - 1)) == 0, "TRACE_BUFFER_EVENTS must be a power of two");
+
+  explicit ring(int tid) : tid(tid), events(new event[SIZE]) {}
+
+  void add(const char *name, uint64_t start, uint64_t end, const char *arg_name, int64_t arg, bool arg_elapsed) {
+    auto i = head.load(std::memory_order_relaxed);
+    auto &e = events[i & (SIZE - 1)];
+    // Pairs with the fence in copy(): a reader that sees any of these stores
+    // also sees head == i, and knows slot i - SIZE is gone
+    std::atomic_thread_fence(std::memory_order_release);
+    e.name.store(name, std::memory_order_relaxed);
+    e.arg_name.store(arg_name, std::memory_order_relaxed);
+    e.start.store(start, std::memory_order_relaxed);
+    e.end.store(end, std::memory_order_relaxed);
+    e.arg.store(arg, std::memory_order_relaxed);
+    e.arg_elapsed.store(arg_elapsed, std::memory_order_relaxed);
+    head.store(i + 1, std::memory_order_release);
+  }
+
+  void copy(std::vector<record> &out) {
+    auto h = head.load(std::memory_order_acquire);
+    auto from = std::max(floor.load(std::memory_order_relaxed), h > SIZE ? h - SIZE : 0);
+    std::vector<record> got;
+    for (auto i = from; i < h; ++i) {
+      auto &e = events[i & (SIZE - 1)];
+      got.push_back(record{e.name.load(std::memory_order_relaxed), e.arg_name.load(std::memory_order_relaxed), e.start.load(std::memory_order_relaxed), e.end.load(std::memory_order_relaxed),
+                           e.arg.load(std::memory_order_relaxed), e.arg_elapsed.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Anything the writer may have lapped while we were reading is suspect
+    auto now = head.load(std::memory_order_relaxed);
+    auto valid = now >= SIZE ? now - SIZE + 1 : 0;
+    for (uint64_t i = from; i < h; ++i) {
+      if (i >= valid) out.push_back(got[i - from]);
+    }
+  }
+
+  void clear() {
+    floor.store(head.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+
+  const int tid;
+  // Set under the registry's lock
+  std::string name;
+
+private:
+  std::atomic<uint64_t> head{0};
+  // Where the exporter starts (moved up by clear())
+  std::atomic<uint64_t> floor{0};
+  std::unique_ptr<event[]> events;
+};
+
+// Every thread's ring, plus a (ticks, steady_clock) pair taken at startup to
+// convert ticks against later. Rings outlive their threads, so a trace saved
+// at the end of the program still shows workers that have exited.
+class registry {
+public:
+  static registry &get() {
+    // Never destroyed: detached threads may still record during exit
+    static registry *r = new registry;
+    return *r;
+  }
+
+  ring &add() {
+    std::lock_guard<std::mutex> lock(m);
+    rings.emplace_back(new ring(static_cast<int>(rings.size()) + 1));
+    return *rings.back();
+  }
+
+  void name(ring &r, std::string name) {
+    std::lock_guard<std::mutex> lock(m);
+    r.name = std::move(name);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(m);
+    for (auto &r : rings) r->clear();
+  }
+
+  void write(FILE *out) {
+    std::lock_guard<std::mutex> lock(m);
+    // Microseconds per tick, measured over the whole run so far
+    auto end_ticks = ticks();
+    auto end_time = std::chrono::steady_clock::now();
+    double us = std::chrono::duration<double, std::micro>(end_time - start_time).count();
+    double per_tick = end_ticks > start_ticks ? us / static_cast<double>(end_ticks - start_ticks) : 1e-3;
+    auto to_us = [&](uint64_t t) { return static_cast<double>(static_cast<int64_t>(t - start_ticks)) * per_tick; };
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char *sep = "";
+    std::vector<record> events;
+    for (auto &r : rings) {
+      if (!r->name.empty()) {
+        fprintf(out, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", sep, r->tid, escaped(r->name).c_str());
+        sep = ",\n";
+      }
+      events.clear();
+      r->copy(events);
+      for (auto &e : events) {
+        fprintf(out, "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f", sep, escaped(e.name).c_str(), r->tid, to_us(e.start), to_us(e.end) - to_us(e.start));
+        if (e.arg_name && e.arg_elapsed) {
+          fprintf(out, ", \"args\": {\"%s\": %.3f}", escaped(e.arg_name).c_str(), static_cast<double>(e.arg) * per_tick);
+        } else if (e.arg_name) {
+          fprintf(out, ", \"args\": {\"%s\": %lld}", escaped(e.arg_name).c_str(), static_cast<long long>(e.arg));
+        }
+        fprintf(out, "}");
+        sep = ",\n";
+      }
+    }
+    fprintf(out, "\n]}\n");
+  }
+
+private:
+  registry() : start_ticks(ticks()), start_time(std::chrono::steady_clock::now()) {}
+
+  static std::string escaped(const std::string &s) {
+    std::string out;
+    for (auto c : s) {
+      if (c == '"' || c == '\\') out += '\\';
+      out += c;
+    }
+    return out;
+  }
+
+  std::mutex m;
+  std::vector<std::unique_ptr<ring>> rings;
+  const uint64_t start_ticks;
+  const std::chrono::steady_clock::time_point start_time;
+};
+
+inline ring &local() {
+  thread_local ring *r = &registry::get().add();
+  return *r;
+}
+}
+
+// Records a span from `start` (from ticks()) to now on this thread, for work
+// that starts somewhere else, e.g. an overlapped recv that completes on an I/O
+// thread. The name (and arg_name) must outlive the program: use literals.
+inline void complete(const char *name, uint64_t start, const char *arg_name = nullptr, int64_t arg = 0) {
+  details::local().add(name, start, ticks(), arg_name, arg, false);
+}
+
+// Times its own lifetime; see TRACE_SPAN
+class span {
+public:
+  explicit span(const char *name) : name(name), arg_name(nullptr), arg(0), arg_elapsed(false), start(ticks()) {}
+
+  span(const char *name, const char *arg_name, int64_t arg) : name(name), arg_name(arg_name), arg(arg), arg_elapsed(false), start(ticks()) {}
+
+  span(const char *name, const char *arg_name, elapsed arg) : name(name), arg_name(arg_name), arg(static_cast<int64_t>(arg.ticks)), arg_elapsed(true), start(ticks()) {}
+
+  span(const span &) = delete;
+  span &operator=(const span &) = delete;
+
+  ~span() {
+    details::local().add(name, start, ticks(), arg_name, arg, arg_elapsed);
+  }
+
+private:
+  const char *name, *arg_name;
+  int64_t arg;
+  bool arg_elapsed;
+  uint64_t start;
+};
+
+// Labels this thread's row in the trace viewer
+inline void name_thread(std::string name) {
+  details::registry::get().name(details::local(), std::move(name));
+}
+
+// Forgets everything recorded so far, e.g. after a warm-up
+inline void clear() {
+  details::registry::get().clear();
+}
+
+// Writes every thread's spans as Chrome trace-event JSON (open it in
+// chrome://tracing or https://ui.perfetto.dev). Safe while other threads
+// are still recording; spans in flight just aren't in it yet.
+inline void write_chrome_json(FILE *out) {
+  details::registry::get().write(out);
+}
+
+inline bool save(const char *path) {
+  FILE *out = nullptr;
+#ifdef _MSC_VER
+  if (fopen_s(&out, path, "w")) return false;
+#else
+  out = fopen(path, "w");
+  if (!out) return false;
+#endif
+  write_chrome_json(out);
+  return fclose(out) == 0;
+}
+}
+}
+
+#endif
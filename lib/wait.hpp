@@ -0,0 +1,162 @@
+#ifndef WAIT_HPP
+#define WAIT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace cs477 {
+
+// Tells the core we're spinning (lets the other hyperthread run, saves power)
+inline void cpu_relax() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Blocking on a 32-bit word without a mutex: atomic_wait() sleeps while
+// `word` still holds `old`, and a notify after changing it wakes the sleepers.
+// Futexes on Linux, WaitOnAddress on Windows, a table of condition variables
+// elsewhere. Wakeups can be spurious, so callers re-check in a loop.
+#if defined(_WIN32)
+inline void atomic_wait(const std::atomic<uint32_t> &word, uint32_t old) {
+  WaitOnAddress(const_cast<std::atomic<uint32_t> *>(&word), &old, sizeof(old), INFINITE);
+}
+
+inline void atomic_notify_one(std::atomic<uint32_t> &word) {
+  WakeByAddressSingle(&word);
+}
+
+inline void atomic_notify_all(std::atomic<uint32_t> &word) {
+  WakeByAddressAll(&word);
+}
+#elif defined(__linux__)
+namespace details {
+inline long futex(const std::atomic<uint32_t> &word, int op, uint32_t value) {
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+  return syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&word), op, value, nullptr, nullptr, 0);
+}
+}
+
+inline void atomic_wait(const std::atomic<uint32_t> &word, uint32_t old) {
+  details::futex(word, FUTEX_WAIT_PRIVATE, old);
+}
+
+inline void atomic_notify_one(std::atomic<uint32_t> &word) {
+  details::futex(word, FUTEX_WAKE_PRIVATE, 1);
+}
+
+inline void atomic_notify_all(std::atomic<uint32_t> &word) {
+  details::futex(word, FUTEX_WAKE_PRIVATE, INT32_MAX);
+}
+#else
+namespace details {
+// Words hash onto a few buckets; a notify wakes the whole bucket
+struct wait_bucket {
+  std::mutex m;
+  std::condition_variable cv;
+};
+
+inline wait_bucket &bucket_for(const void *p) {
+  static wait_bucket buckets[16];
+  return buckets[(reinterpret_cast<uintptr_t>(p) >> 4) % 16];
+}
+}
+
+inline void atomic_wait(const std::atomic<uint32_t> &word, uint32_t old) {
+  auto &b = details::bucket_for(&word);
+  std::unique_lock<std::mutex> lock(b.m);
+  if (word.load(std::memory_order_acquire) == old) b.cv.wait(lock);
+}
+
+inline void atomic_notify_all(std::atomic<uint32_t> &word) {
+  auto &b = details::bucket_for(&word);
+  {
+    // Orders the notify after a waiter's check of the word
+    std::lock_guard<std::mutex> lock(b.m);
+  }
+  b.cv.notify_all();
+}
+
+inline void atomic_notify_one(std::atomic<uint32_t> &word) {
+  atomic_notify_all(word);
+}
+#endif
+
+// Lets threads sleep until a condition they can check themselves holds (an
+// item in a queue, room in a ring), without a mutex on either side. Whoever
+// makes the condition true calls notify_*(), which costs a fence and a load
+// while nobody is asleep.
+class eventcount {
+public:
+  // Returns once ready() is true: spins a little first, then sleeps. The
+  // sleeper count and the re-check of ready() pair up with the fence in
+  // notify (a Dekker handshake), so a wakeup can't slip in between.
+  template <typename Ready>
+  void wait_until(Ready ready) {
+    for (int i = 0; i < SPINS; ++i) {
+      if (ready()) return;
+      cpu_relax();
+    }
+    for (;;) {
+      auto e = epoch.load(std::memory_order_acquire);
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) {
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      atomic_wait(epoch, e);
+      sleepers.fetch_sub(1, std::memory_order_relaxed);
+      if (ready()) return;
+    }
+  }
+
+  // Wakes a sleeper. Every notify wakes one, even while an earlier one is
+  // still on its way up: that thread takes one item, and the next has to be
+  // somebody else's.
+  void notify_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) == 0) return;
+    epoch.fetch_add(1, std::memory_order_release);
+    atomic_notify_one(epoch);
+  }
+
+  void notify_all() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) == 0) return;
+    epoch.fetch_add(1, std::memory_order_release);
+    atomic_notify_all(epoch);
+  }
+
+private:
+  static const int SPINS = 64;
+
+  // Keeps the words notify touches off whatever comes before us
+  char pad[64];
+  std::atomic<uint32_t> epoch{0};
+  std::atomic<int> sleepers{0};
+};
+}
+
+#endif
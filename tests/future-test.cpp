@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "../lib/future.hpp"
+
+//Continuations and broken promises, all on the calling thread: futures are
+//settled by hand, so every continuation runs inline and can be checked
+//right after.
+
+static int failures = 0;
+
+#define CHECK(x)                                              \
+  do {                                                        \
+    if (!(x)) {                                               \
+      printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #x);  \
+      failures++;                                             \
+    }                                                         \
+  } while (0)
+
+//when_any() hooks every future it's given; a then() added afterwards must
+//not knock that hook off, or the race is never decided
+static void when_any_then_then() {
+  std::vector<cs477::promise<int>> ps(3);
+  std::vector<cs477::future<int>> fs;
+  for (auto& p : ps) fs.push_back(p.get_future());
+  auto any = cs477::when_any(fs.begin(), fs.end());
+  int seen = -1;
+  auto after = fs[1].then([&](cs477::future<int> f) {
+    seen = f.get();
+    return seen * 2;
+  });
+  ps[1].set_value(21);
+  //Checked before get(), which would block forever on a lost hook
+  bool decided = any.is_ready();
+  CHECK(decided);
+  if (decided) CHECK(any.get() == 1);
+  CHECK(seen == 21);
+  CHECK(after.get() == 42);
+  ps[0].set_value(0);
+  ps[2].set_value(2);
+}
+
+//Several when_ready() hooks on one future all run, in order
+static void continuations_in_order() {
+  cs477::promise<void> p;
+  auto f = p.get_future();
+  std::vector<int> order;
+  for (int i = 0; i < 4; i++) CHECK(f.when_ready([&order, i]() { order.push_back(i); }));
+  CHECK(order.empty());
+  p.set_value();
+  CHECK((order == std::vector<int>{0, 1, 2, 3}));
+  CHECK(!f.when_ready([]() {}));
+}
+
+//Assigning over a promise breaks the one it held, as destroying it would;
+//the future of the promise moved in is untouched
+static void move_assign_breaks() {
+  cs477::promise<int> p, q;
+  auto f = p.get_future(), g = q.get_future();
+  p = std::move(q);
+  bool broken = false;
+  if (f.is_ready()) {
+    try {
+      f.get();
+    } catch (const std::future_error& e) {
+      broken = e.code() == std::future_errc::broken_promise;
+    }
+  }
+  CHECK(broken);
+  CHECK(!g.is_ready());
+  p.set_value(7);
+  CHECK(g.get() == 7);
+
+  //A satisfied one is left as it was
+  cs477::promise<int> r, t;
+  auto h = r.get_future();
+  r.set_value(1);
+  r = std::move(t);
+  CHECK(h.get() == 1);
+}
+
+int main() {
+  when_any_then_then();
+  continuations_in_order();
+  move_assign_breaks();
+  printf("future-test: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
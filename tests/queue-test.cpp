@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "../lib/queue.hpp"
+
+//Blocking queues handing over a fixed number of items, without close():
+//close() wakes everybody, which would hide a lost wakeup. A watchdog fails
+//the test instead of letting it hang.
+
+static int failures = 0;
+
+#define CHECK(x)                                              \
+  do {                                                        \
+    if (!(x)) {                                               \
+      printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #x);  \
+      failures++;                                             \
+    }                                                         \
+  } while (0)
+
+//Waits up to a few seconds for n to reach want
+static bool reaches(const std::atomic<int>& n, int want) {
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (n.load() < want) {
+    if (std::chrono::steady_clock::now() > until) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+//Every consumer is asleep in pop() before a handful of producers push one
+//item per consumer; every item has to wake somebody
+static void mpmc_wakes_every_consumer() {
+  const int CONSUMERS = 8, PRODUCERS = 4;
+  for (int run = 0; run < 30; run++) {
+    cs477::mpmc_queue<int> q(64);
+    std::atomic<int> popped{0}, sum{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < CONSUMERS; i++) {
+      threads.emplace_back([&]() {
+        int v;
+        if (q.pop(v)) {
+          sum += v;
+          popped++;
+        }
+      });
+    }
+    //Long enough for them all to get past spinning
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (int p = 0; p < PRODUCERS; p++) {
+      threads.emplace_back([&, p]() {
+        for (int i = 0; i < CONSUMERS / PRODUCERS; i++) q.push(p * 10 + i);
+      });
+    }
+    bool all = reaches(popped, CONSUMERS);
+    CHECK(all);
+    if (!all) {
+      printf("  run %d: %d of %d items taken\n", run, popped.load(), CONSUMERS);
+      //Let the stragglers out so the threads can be joined
+      q.close();
+    }
+    for (auto& t : threads) t.join();
+    if (!all) return;
+    CHECK(sum.load() == 0 + 1 + 10 + 11 + 20 + 21 + 30 + 31);
+  }
+}
+
+//A bounded queue much smaller than the item count: producers sleep on a
+//full queue and consumers on an empty one, over and over
+static void mpmc_fixed_count() {
+  const int THREADS = 4, ITEMS = 100000;
+  cs477::mpmc_queue<int> q(8);
+  std::atomic<int> popped{0};
+  std::atomic<long long> sum{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; i++) {
+    threads.emplace_back([&]() {
+      for (int k = 0; k < ITEMS / THREADS; k++) {
+        int v;
+        if (!q.pop(v)) return;
+        sum += v;
+        popped++;
+      }
+    });
+    threads.emplace_back([&, i]() {
+      for (int k = 0; k < ITEMS / THREADS; k++) q.push(i * (ITEMS / THREADS) + k);
+    });
+  }
+  bool all = reaches(popped, ITEMS);
+  CHECK(all);
+  if (!all) q.close();
+  for (auto& t : threads) t.join();
+  CHECK(sum.load() == static_cast<long long>(ITEMS) * (ITEMS - 1) / 2);
+}
+
+//A pipeline stage's channel: one producer, one consumer, a fixed count,
+//a ring much smaller than the count so both sides block over and over
+static void spsc_fixed_count() {
+  const int ITEMS = 200000;
+  cs477::spsc_channel<int> c(4);
+  std::atomic<int> popped{0};
+  long long sum = 0;
+  bool in_order = true;
+  std::thread consumer([&]() {
+    for (int k = 0; k < ITEMS; k++) {
+      int v;
+      if (!c.pop(v)) return;
+      in_order = in_order && v == k;
+      sum += v;
+      popped++;
+    }
+  });
+  std::thread producer([&]() {
+    for (int k = 0; k < ITEMS; k++) c.push(k);
+  });
+  bool all = reaches(popped, ITEMS);
+  CHECK(all);
+  if (!all) c.close();
+  producer.join();
+  consumer.join();
+  CHECK(in_order);
+  CHECK(sum == static_cast<long long>(ITEMS) * (ITEMS - 1) / 2);
+}
+
+//Batches: try_write() several, flush() once, try_pop_n() on the other side
+static void spsc_batches() {
+  const int ITEMS = 100000;
+  cs477::spsc_channel<int> c(64);
+  std::atomic<int> popped{0};
+  bool in_order = true;
+  std::thread consumer([&]() {
+    int buf[16], next = 0;
+    while (next < ITEMS) {
+      auto n = c.try_pop_n(buf, 16);
+      if (!n) {
+        int v;
+        if (!c.pop(v)) return;
+        buf[0] = v;
+        n = 1;
+      }
+      for (size_t i = 0; i < n; i++) in_order = in_order && buf[i] == next++;
+      popped += static_cast<int>(n);
+    }
+  });
+  for (int k = 0; k < ITEMS;) {
+    while (k < ITEMS && c.try_write(int(k))) k++;
+    c.flush();
+    std::this_thread::yield();
+  }
+  bool all = reaches(popped, ITEMS);
+  CHECK(all);
+  if (!all) c.close();
+  consumer.join();
+  CHECK(in_order);
+}
+
+int main() {
+  mpmc_wakes_every_consumer();
+  mpmc_fixed_count();
+  spsc_fixed_count();
+  spsc_batches();
+  printf("queue-test: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}